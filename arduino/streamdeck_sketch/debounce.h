@@ -0,0 +1,40 @@
+// button debouncing, shared by the sketch and the FakeDeck of the driver (plain C++, no Arduino functions)
+
+#ifndef STREAMDECK_DEBOUNCE_H
+#define STREAMDECK_DEBOUNCE_H
+
+#define DEBOUNCE_TICK          1000 // (us) release integrators count down once per tick
+#define DEBOUNCE_RELEASE_TICKS 10   // ticks a button has to read released in a row before the next press counts
+
+#define DEBOUNCE_SUPPRESS      0x80 // integrator flag: the press was not reported (held while connecting), so the release is not either
+
+// edges returned by debounce()
+#define DEBOUNCE_PRESS   1
+#define DEBOUNCE_RELEASE 2
+
+// eager integrator of one button: 0 = released, >0 = pressed or bouncing back
+typedef unsigned char debounce_t;
+
+// feed one raw sample of the button (tick: first sample of a new DEBOUNCE_TICK), returns the edge it completed (or 0).
+// The press is reported on the very first pressed sample, contact bounce afterwards only refills the integrator
+// so it never repeats the press. The release is reported once the button read released for DEBOUNCE_RELEASE_TICKS,
+// so it happened DEBOUNCE_RELEASE_TICKS*DEBOUNCE_TICK us earlier
+inline int debounce(debounce_t * integrator, int raw_pressed, int tick)
+{
+  if(raw_pressed){
+    int edge = (*integrator == 0) ? DEBOUNCE_PRESS : 0;
+    *integrator = (*integrator & DEBOUNCE_SUPPRESS) | DEBOUNCE_RELEASE_TICKS;
+    return edge;
+  }
+  if(tick && (*integrator & ~DEBOUNCE_SUPPRESS) > 0){
+    (*integrator)--;
+    if((*integrator & ~DEBOUNCE_SUPPRESS) == 0){
+      int reported = !(*integrator & DEBOUNCE_SUPPRESS);
+      *integrator = 0;
+      return reported ? DEBOUNCE_RELEASE : 0;
+    }
+  }
+  return 0;
+}
+
+#endif
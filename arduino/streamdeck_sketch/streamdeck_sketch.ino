@@ -1,18 +1,52 @@
+#include "debounce.h"
+
 #define MAGIC_WORDS       "ccstreamdeck" // first words that are send so the pc knows that this is the stream deck
 
-#define BAUD_RATE         9600  // baud rate for serial communication
-#define NUM_BUTTONS       16     // number of physical buttons connected 
+#define BAUD_RATE         9600  // baud rate for handshake and protocol v1
+#define BAUD_RATE_V2      115200 // baud rate after the host negotiated protocol v2
+#define DECK_ID           0     // tells decks attached to the same host apart, selects the [deck X] section of the driver config
 #define GREEN_LED_PIN     12    // IO pin of green led
 #define RED_LED_PIN       13    // IO pin of red led
 
-#define BUTTON_TRIGGER_COOLDOWN 100 // (ms) how long until trigger event can be sent again
 #define CONNECTION_LOST_TIMEOUT 500 // (ms) how long until connection is lost if no
+#define HANDSHAKE_INTERVAL 1000     // (ms) how often the magic words are sent while not connected
+#define BLINK_INTERVAL 500          // (ms) red led blink interval while not connected
+#define RESEND_TIMEOUT 30           // (ms) resend event frames not acknowledged by the host after this
+#define RESEND_QUEUE_SIZE 8         // number of unacknowledged event frames kept
+
+// protocol v2 frames: SOF | length | sequence | type | payload | crc8 (length..payload)
+// (see streamdeck_driver/Protocol.h)
+#define PROTOCOL_V1       1
+#define PROTOCOL_V2       2
+#define FRAME_SOF         0xA5
+#define FRAME_HEADER_SIZE 4
+#define FRAME_MAX_PAYLOAD 16
+#define FRAME_MAX_SIZE    (FRAME_HEADER_SIZE+FRAME_MAX_PAYLOAD+1)
+#define FRAME_HELLO       0x01 // host -> deck: version, baud code
+#define FRAME_HELLO_ACK   0x02 // deck -> host: version, number of buttons, deck id, features
+#define FRAME_BUTTON      0x03 // deck -> host: button id (not sent by this firmware)
+#define FRAME_STATE       0x04 // host -> deck: active, sequence number of last event frame received
+#define FRAME_EVENT       0x05 // deck -> host: button id, edge, time (us, 4 bytes little endian)
+#define FRAME_LEDS        0x06 // host -> deck: byte offset, busy bitmap from button offset*8+1 on (sent when it changes)
+#define DECK_FEATURE_EVENTS 0x01 // FRAME_EVENT is sent for presses and releases
+#define DECK_FEATURE_LEDS 0x02   // busy state of each button is shown, the host sends FRAME_LEDS
+#define EDGE_PRESS        1
+#define EDGE_RELEASE      2
+#define EVENT_PAYLOAD_SIZE 6
 
 #define PULL_UP_RESISTOR  // if PULL_UP_RESISTOR is defined, buttons connect input pins to GROUND when pressed, the internal pull up resistors of the arduino are used
                           // if PULL_UP_RESISTOR is NOT defined, buttons connect input pins to VDD when pressed, external pull down resistors have to be connected to the arduino
 
-// assign gpio pin to each button
-int BUTTON_PINS[NUM_BUTTONS] = {
+//#define BUTTON_LEDS     // if BUTTON_LEDS is defined, a led next to each button lights up while the button's group is busy (pressing it is ignored)
+                          // the leds are driven by a chain of 74HC595 shift registers, button 1 on output Q0 of the register connected to the arduino
+                          // (an uno has no pins left with 16 buttons, the pins below are those of a mega)
+#define LED_DATA_PIN      20 // serial input (DS) of the first shift register
+#define LED_CLOCK_PIN     21 // shift clock (SHCP) of all registers
+#define LED_LATCH_PIN     22 // storage clock (STCP) of all registers
+#define LED_BITS_PER_PASS 8  // bits shifted out per pass of loop(), so updating the leds never delays the button scan
+
+// assign gpio pin to each button, the number of buttons is reported to the host
+int BUTTON_PINS[] = {
   2, // button 1
   3, // button 2
   4, // button 3
@@ -30,31 +64,309 @@ int BUTTON_PINS[NUM_BUTTONS] = {
   18,// button 15
   19 // button 16
 };
+#define NUM_BUTTONS ((int)(sizeof(BUTTON_PINS)/sizeof(BUTTON_PINS[0]))) // number of physical buttons connected
+#define MAX_INPUT_PORTS 12 // number of different port registers the buttons can be spread over
+
+// input registers of the ports the buttons are connected to, each is read once per scan
+volatile uint8_t * INPUT_PORTS[MAX_INPUT_PORTS];
+byte NUM_INPUT_PORTS = 0;
 
-// array keeping track of button states (1: pressed, 0: released)
-int BUTTON_STATES[NUM_BUTTONS];
+// port (index into INPUT_PORTS) and bit of each button
+byte BUTTON_PORT[NUM_BUTTONS];
+byte BUTTON_MASK[NUM_BUTTONS];
 
-// keep track of last button trigger
-unsigned long LAST_BUTTON_TRIGGER_TIME[NUM_BUTTONS];
+// debounce integrator of each button
+debounce_t BUTTON_DEBOUNCE[NUM_BUTTONS];
+unsigned long LAST_DEBOUNCE_TICK = 0; // (us)
 
-// buffer for reading incoming data
-#define READ_BUFFER_SIZE  256
-char READ_BUFFER[READ_BUFFER_SIZE];
+#define LED_BYTES ((NUM_BUTTONS+7)/8) // busy bitmap size, also the number of shift registers
+#ifdef BUTTON_LEDS
+  #define DECK_FEATURES (DECK_FEATURE_EVENTS | DECK_FEATURE_LEDS)
+#else
+  #define DECK_FEATURES DECK_FEATURE_EVENTS
+#endif
+byte LED_BITMAP[LED_BYTES]; // busy state of each button received from the host (bit 0 of the first byte: button 1)
+int LED_SHIFT_POS = -1; // next bit to shift out (counting down), -1 while the registers show LED_BITMAP
 
 byte BUTTON_ACTIVE = 0; // key sequence is currently being processed (send by host)
 unsigned long LAST_ACTIVE_RECEIVED = 0;
 
 int CONNECTED = 0;
+unsigned long LAST_HANDSHAKE_SENT = 0;
+int MAGIC_WORDS_RECEIVED = 0; // number of characters of the magic words sent back by host so far
+
+int PROTOCOL = PROTOCOL_V1; // protocol negotiated with the host
+
+// frame being received
+byte RX_FRAME[FRAME_MAX_SIZE];
+int RX_POS = 0;
+
+// sequence number of next frame sent
+byte TX_SEQ = 0;
+
+// event frames not yet acknowledged by the host (v2)
+byte UNACKED_SEQ[RESEND_QUEUE_SIZE];
+byte UNACKED_EVENT[RESEND_QUEUE_SIZE][EVENT_PAYLOAD_SIZE];
+int UNACKED_COUNT = 0;
+unsigned long LAST_SEND_TIME = 0;
+
+// crc-8 (polynomial 0x07), same as the driver
+byte crc8(const byte * data, int length)
+{
+  byte crc = 0;
+  for(int i = 0; i < length; i++){
+    crc ^= data[i];
+    for(int bit = 0; bit < 8; bit++){
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+void send_frame(byte seq, byte type, const byte * payload, byte length)
+{
+  byte frame[FRAME_MAX_SIZE];
+  frame[0] = FRAME_SOF;
+  frame[1] = length;
+  frame[2] = seq;
+  frame[3] = type;
+  for(int i = 0; i < length; i++){
+    frame[FRAME_HEADER_SIZE+i] = payload[i];
+  }
+  frame[FRAME_HEADER_SIZE+length] = crc8(frame+1, FRAME_HEADER_SIZE-1+length);
+  Serial.write(frame, FRAME_HEADER_SIZE+length+1);
+}
+
+// feed received byte, returns 1 if RX_FRAME holds a complete and valid frame
+int receive_frame(byte c)
+{
+  if(RX_POS == 0 && c != FRAME_SOF){
+    return 0;
+  }
+  if(RX_POS == 1 && c > FRAME_MAX_PAYLOAD){
+    RX_POS = (c == FRAME_SOF) ? 1 : 0;
+    return 0;
+  }
+  RX_FRAME[RX_POS++] = c;
+  if(RX_POS < FRAME_HEADER_SIZE+1 || RX_POS < FRAME_HEADER_SIZE+RX_FRAME[1]+1){
+    return 0;
+  }
+  RX_POS = 0;
+  return crc8(RX_FRAME+1, FRAME_HEADER_SIZE-1+RX_FRAME[1]) == RX_FRAME[FRAME_HEADER_SIZE+RX_FRAME[1]];
+}
+
+void copy_event(byte * to, const byte * from)
+{
+  for(int i = 0; i < EVENT_PAYLOAD_SIZE; i++){
+    to[i] = from[i];
+  }
+}
+
+// button edge at time (us), v1 only knows presses
+void send_event(byte btn_id, byte edge, unsigned long time)
+{
+  if(PROTOCOL == PROTOCOL_V1){
+    if(edge == EDGE_PRESS){
+      Serial.write(&btn_id, 1);
+    }
+    return;
+  }
+  if(UNACKED_COUNT == RESEND_QUEUE_SIZE){// queue full, oldest event is lost
+    for(int i = 1; i < UNACKED_COUNT; i++){
+      UNACKED_SEQ[i-1] = UNACKED_SEQ[i];
+      copy_event(UNACKED_EVENT[i-1], UNACKED_EVENT[i]);
+    }
+    UNACKED_COUNT--;
+  }
+  byte * event = UNACKED_EVENT[UNACKED_COUNT];
+  event[0] = btn_id;
+  event[1] = edge;
+  for(int i = 0; i < 4; i++){
+    event[2+i] = (time >> (8*i)) & 0xFF;
+  }
+  UNACKED_SEQ[UNACKED_COUNT] = TX_SEQ;
+  UNACKED_COUNT++;
+  send_frame(TX_SEQ++, FRAME_EVENT, event, EVENT_PAYLOAD_SIZE);
+  LAST_SEND_TIME = millis();
+}
+
+// host received all button frames up to seq
+void acknowledge(byte seq)
+{
+  int acked = 0;
+  while(acked < UNACKED_COUNT && (byte)(seq - UNACKED_SEQ[acked]) < 128){
+    acked++;
+  }
+  for(int i = acked; i < UNACKED_COUNT; i++){
+    UNACKED_SEQ[i-acked] = UNACKED_SEQ[i];
+    copy_event(UNACKED_EVENT[i-acked], UNACKED_EVENT[i]);
+  }
+  UNACKED_COUNT -= acked;
+}
+
+void resend_unacked()
+{
+  if(UNACKED_COUNT == 0 || millis() - LAST_SEND_TIME < RESEND_TIMEOUT){
+    return;
+  }
+  for(int i = 0; i < UNACKED_COUNT; i++){
+    send_frame(UNACKED_SEQ[i], FRAME_EVENT, UNACKED_EVENT[i], EVENT_PAYLOAD_SIZE);
+  }
+  LAST_SEND_TIME = millis();
+}
+
+void set_active(byte active)
+{
+  BUTTON_ACTIVE = (active != 0);
+  digitalWrite(GREEN_LED_PIN, BUTTON_ACTIVE);
+  LAST_ACTIVE_RECEIVED = millis();
+}
+
+// part of the bitmap changed, the registers are refilled by update_leds()
+void set_leds(const byte * payload, byte length)
+{
+  for(int i = 1; i < length; i++){
+    if(payload[0]+i-1 < LED_BYTES){
+      LED_BITMAP[payload[0]+i-1] = payload[i];
+    }
+  }
+  // restarting an update in progress is fine, the outputs only change with the latch
+  LED_SHIFT_POS = 8*LED_BYTES-1;
+}
+
+void clear_leds()
+{
+  for(int i = 0; i < LED_BYTES; i++){
+    LED_BITMAP[i] = 0;
+  }
+  LED_SHIFT_POS = 8*LED_BYTES-1;
+}
+
+// non blocking led update, shifts a few bits per call and latches them once all are in
+void update_leds()
+{
+  if(LED_SHIFT_POS < 0){
+    return;
+  }
+  #ifdef BUTTON_LEDS
+    // highest bit first, it has to travel to the last register of the chain
+    for(int n = 0; n < LED_BITS_PER_PASS && LED_SHIFT_POS >= 0; n++, LED_SHIFT_POS--){
+      digitalWrite(LED_DATA_PIN, (LED_BITMAP[LED_SHIFT_POS/8] >> (LED_SHIFT_POS%8)) & 1);
+      digitalWrite(LED_CLOCK_PIN, HIGH);
+      digitalWrite(LED_CLOCK_PIN, LOW);
+    }
+    if(LED_SHIFT_POS < 0){
+      digitalWrite(LED_LATCH_PIN, HIGH);
+      digitalWrite(LED_LATCH_PIN, LOW);
+    }
+  #else
+    LED_SHIFT_POS = -1;
+  #endif
+}
+
+// process data received by host (button active or not, protocol negotiation)
+void receive()
+{
+  while(Serial.available() > 0){
+    byte b = Serial.read();
+    if(PROTOCOL == PROTOCOL_V1 && (b == 0 || b == 1)){
+      set_active(b);
+    }
+    if(!receive_frame(b)){
+      continue;
+    }
+    byte type = RX_FRAME[3];
+    byte * payload = RX_FRAME+FRAME_HEADER_SIZE;
+    if(type == FRAME_HELLO && PROTOCOL == PROTOCOL_V1 && RX_FRAME[1] >= 2 && payload[0] >= PROTOCOL_V2){
+      byte ack[4] = {PROTOCOL_V2, NUM_BUTTONS, DECK_ID, DECK_FEATURES};
+      send_frame(TX_SEQ++, FRAME_HELLO_ACK, ack, 4);
+      Serial.flush();
+      Serial.begin(BAUD_RATE_V2);
+      PROTOCOL = PROTOCOL_V2;
+      LAST_ACTIVE_RECEIVED = millis();
+    }
+    else if(type == FRAME_STATE && PROTOCOL == PROTOCOL_V2 && RX_FRAME[1] >= 2){
+      set_active(payload[0]);
+      acknowledge(payload[1]);
+    }
+    else if(type == FRAME_LEDS && PROTOCOL == PROTOCOL_V2 && RX_FRAME[1] >= 1){
+      set_leds(payload, RX_FRAME[1]);
+    }
+  }
+}
+
+// (re)start handshake: magic words are sent periodically until the host sends them back
+void start_handshake()
+{
+  if(PROTOCOL != PROTOCOL_V1){
+    Serial.flush();
+    Serial.begin(BAUD_RATE);
+    PROTOCOL = PROTOCOL_V1;
+  }
+  CONNECTED = 0;
+  MAGIC_WORDS_RECEIVED = 0;
+  RX_POS = 0;
+  TX_SEQ = 0;
+  UNACKED_COUNT = 0;
+  LAST_HANDSHAKE_SENT = millis() - HANDSHAKE_INTERVAL;
+  digitalWrite(GREEN_LED_PIN, LOW);
+  clear_leds();
+}
+
+// non blocking handshake, called from loop() while not connected
+void handshake()
+{
+  if(millis() - LAST_HANDSHAKE_SENT >= HANDSHAKE_INTERVAL){
+    Serial.write(MAGIC_WORDS);
+    LAST_HANDSHAKE_SENT = millis();
+  }
+
+  int magic_words_len = strlen(MAGIC_WORDS);
+  while(Serial.available() > 0){
+    char c = Serial.read();
+    if(c == MAGIC_WORDS[MAGIC_WORDS_RECEIVED]){
+      MAGIC_WORDS_RECEIVED++;
+    }
+    else{
+      MAGIC_WORDS_RECEIVED = (c == MAGIC_WORDS[0]) ? 1 : 0;
+    }
+    if(MAGIC_WORDS_RECEIVED == magic_words_len){// magic word sent back is correct -> connect
+      digitalWrite(RED_LED_PIN, HIGH);
+      CONNECTED = 1;
+      byte zer0 = 0;
+      Serial.write(&zer0, 1);
+      LAST_ACTIVE_RECEIVED = millis();
+      // buttons held while connecting only count after they were released
+      for(int i = 0; i < NUM_BUTTONS; i++){
+        BUTTON_DEBOUNCE[i] = DEBOUNCE_SUPPRESS | DEBOUNCE_RELEASE_TICKS;
+      }
+      return;
+    }
+  }
+
+  // send signal - not connected
+  digitalWrite(RED_LED_PIN, (millis()/BLINK_INTERVAL) % 2 == 0 ? HIGH : LOW);
+}
+
 void setup() {
-  // set button pins as input
+  // set button pins as input and look up their port registers
   for(int i = 0; i < NUM_BUTTONS; i++){
-    BUTTON_STATES[i] = 0;
-    LAST_BUTTON_TRIGGER_TIME[i] = 0;
     #ifdef PULL_UP_RESISTOR
       pinMode(BUTTON_PINS[i], INPUT_PULLUP);
     #else
       pinMode(BUTTON_PINS[i], INPUT);
     #endif
+    volatile uint8_t * port = portInputRegister(digitalPinToPort(BUTTON_PINS[i]));
+    byte p = 0;
+    while(p < NUM_INPUT_PORTS && INPUT_PORTS[p] != port){
+      p++;
+    }
+    if(p == NUM_INPUT_PORTS){
+      INPUT_PORTS[NUM_INPUT_PORTS++] = port;
+    }
+    BUTTON_PORT[i] = p;
+    BUTTON_MASK[i] = digitalPinToBitMask(BUTTON_PINS[i]);
+    BUTTON_DEBOUNCE[i] = 0;
   }
 
   // set led pins as output
@@ -62,68 +374,60 @@ void setup() {
   pinMode(GREEN_LED_PIN, OUTPUT);
   digitalWrite(RED_LED_PIN, LOW);
   digitalWrite(GREEN_LED_PIN, LOW);
+  #ifdef BUTTON_LEDS
+    pinMode(LED_DATA_PIN, OUTPUT);
+    pinMode(LED_CLOCK_PIN, OUTPUT);
+    pinMode(LED_LATCH_PIN, OUTPUT);
+  #endif
 
-  // initialize serial communication and check magic word sent back
+  // initialize serial communication, handshake is done in loop()
   Serial.begin(BAUD_RATE);
-  Serial.write(MAGIC_WORDS);
-  Serial.flush();
-  int magic_words_len = strlen(MAGIC_WORDS);
-  int read_bytes = 0;
-  while(read_bytes < magic_words_len){
-    read_bytes += Serial.readBytes(READ_BUFFER+read_bytes, READ_BUFFER_SIZE-read_bytes);
-  }
-  READ_BUFFER[magic_words_len] = '\0';
-  if(!strcmp(READ_BUFFER, MAGIC_WORDS)){// magic word sent back is correct -> connect
-    digitalWrite(RED_LED_PIN, HIGH);
-    CONNECTED = 1;
-    byte zer0 = 0;
-    Serial.write(&zer0, 1);
-    LAST_ACTIVE_RECEIVED = millis();
-  }
-  
+  start_handshake();
 }
 
-void check_time_overflow(int i)
+// sample all buttons (one read per port register) and send their edges
+void scan_buttons()
 {
-  if(millis() < LAST_BUTTON_TRIGGER_TIME[i]) // millis flowed over
-    LAST_BUTTON_TRIGGER_TIME[i] = 0;
+  byte levels[MAX_INPUT_PORTS];
+  for(byte p = 0; p < NUM_INPUT_PORTS; p++){
+    levels[p] = *INPUT_PORTS[p];
+  }
+  unsigned long now = micros();
+  int tick = (now - LAST_DEBOUNCE_TICK >= DEBOUNCE_TICK);
+  if(tick){
+    LAST_DEBOUNCE_TICK = now;
+  }
+  for(byte i = 0; i < NUM_BUTTONS; i++){
+    #ifdef PULL_UP_RESISTOR
+      int pressed = (levels[BUTTON_PORT[i]] & BUTTON_MASK[i]) == 0;
+    #else
+      int pressed = (levels[BUTTON_PORT[i]] & BUTTON_MASK[i]) != 0;
+    #endif
+    int edge = debounce(&BUTTON_DEBOUNCE[i], pressed, tick);
+    if(edge == DEBOUNCE_PRESS){
+      send_event(i+1, EDGE_PRESS, now);
+    }
+    else if(edge == DEBOUNCE_RELEASE){
+      send_event(i+1, EDGE_RELEASE, now - (unsigned long)DEBOUNCE_RELEASE_TICKS*DEBOUNCE_TICK);
+    }
+  }
 }
 
 void loop() {
   if(CONNECTED){
-    // check buttons pressed
-    for(byte i = 0; i < NUM_BUTTONS; i++){
-      int btn_state_before = BUTTON_STATES[i];
-      BUTTON_STATES[i] = digitalRead(BUTTON_PINS[i]);
-      #ifdef PULL_UP_RESISTOR
-        BUTTON_STATES[i] = 1-BUTTON_STATES[i];
-      #endif
-      check_time_overflow(i);
-      if(btn_state_before == 0 && BUTTON_STATES[i] == 1 && (millis()-LAST_BUTTON_TRIGGER_TIME[i]) > BUTTON_TRIGGER_COOLDOWN){
-        byte btn_id = i+1;
-        Serial.write(&btn_id, 1);
-        LAST_BUTTON_TRIGGER_TIME[i] = millis();
-      }
-    }
+    // nothing in here blocks, so a press is seen within one pass of the loop
+    scan_buttons();
 
     // check data received by host (button active or not)
-    byte b;
-    if(Serial.readBytes(&b, 1) == 1){
-      BUTTON_ACTIVE = (b != 0);
-      digitalWrite(GREEN_LED_PIN, BUTTON_ACTIVE);
-      LAST_ACTIVE_RECEIVED = millis();
-    }
+    receive();
+    resend_unacked();
     if(millis() - LAST_ACTIVE_RECEIVED >= CONNECTION_LOST_TIMEOUT){
-      CONNECTED = false;
-      digitalWrite(GREEN_LED_PIN, LOW);
+      // host is gone (driver restarted, pc asleep), wait until it comes back
+      start_handshake();
     }
-    delay(1); 
   }
   else{
-    // send signal - not connected
-    digitalWrite(RED_LED_PIN, HIGH);
-    delay(500);
-    digitalWrite(RED_LED_PIN, LOW);
-    delay(500);
+    handshake();
   }
+  update_leds();
 }
@@ -0,0 +1,30 @@
+#include "Clock.h"
+
+#ifdef _WIN32
+
+ULONGLONG getMonotonicMicros()
+{
+	static LARGE_INTEGER frequency = {0};
+	if(frequency.QuadPart == 0){
+		QueryPerformanceFrequency(&frequency);
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	// split to avoid overflowing counter*1000000 after a few days of uptime
+	ULONGLONG seconds = counter.QuadPart/frequency.QuadPart;
+	ULONGLONG rest = counter.QuadPart%frequency.QuadPart;
+	return seconds*1000000 + rest*1000000/frequency.QuadPart;
+}
+
+#else
+
+#include <time.h>
+
+ULONGLONG getMonotonicMicros()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return static_cast<ULONGLONG>(t.tv_sec)*1000000 + t.tv_nsec/1000;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "Platform.h"
+
+#define DEADLINE_NONE ((ULONGLONG)-1) // no deadline, wait forever
+
+#define MILLIS_TO_MICROS(ms) (static_cast<ULONGLONG>(ms)*1000)
+
+// monotonic time in microseconds since an arbitrary point (QueryPerformanceCounter / CLOCK_MONOTONIC),
+// unlike the system time it never jumps when the clock is adjusted
+ULONGLONG getMonotonicMicros();
+
+#endif
@@ -0,0 +1,233 @@
+#include "DeckLink.h"
+#include "Log.h"
+#include <string.h>
+
+DeckLink::DeckLink(Serial * serial):
+	_serial(serial), _version(PROTOCOL_V1), _numButtons(DEVICE_NUM_BUTTONS), _deckID(DEFAULT_DECK_ID), _features(0), _txSeq(0), _rxNext(0), _duplicates(0),
+	_active(false), _stateDirty(true), _lastStateSent(0), _ledsDirty(0)
+{
+	memset(_leds, 0, sizeof(_leds));
+}
+
+int DeckLink::negotiate()
+{
+	unsigned char hello[2] = {PROTOCOL_V2, BAUD_CODE_115200};
+	if(!sendFrame(FRAME_HELLO, hello, sizeof(hello))){
+		return _version;
+	}
+
+	// old firmware takes the HELLO bytes for active states and never answers
+	ULONGLONG deadline = getMonotonicMicros() + MILLIS_TO_MICROS(NEGOTIATION_TIMEOUT);
+	char buffer[64];
+	Frame frame;
+	while(_version == PROTOCOL_V1 && _serial->IsConnected()){
+		ULONGLONG now = getMonotonicMicros();
+		if(now >= deadline)
+			break;
+		int remaining = static_cast<int>((deadline - now + 999)/1000);
+		int bytes_read = _serial->ReadData(buffer, sizeof(buffer), remaining);
+		for(int i = 0; i < bytes_read; i++){
+			if(_decoder.feed(static_cast<unsigned char>(buffer[i]), frame) && frame.type == FRAME_HELLO_ACK && frame.length >= 2){
+				_version = frame.payload[0] >= PROTOCOL_V2 ? PROTOCOL_V2 : PROTOCOL_V1;
+				_numButtons = frame.payload[1];
+				if(frame.length >= 3)
+					_deckID = frame.payload[2];
+				if(frame.length >= 4)
+					_features = frame.payload[3];
+				_rxNext = frame.seq+1;
+				break;
+			}
+		}
+	}
+
+	if(_version == PROTOCOL_V2){
+		// the deck switched after sending the ack, the first STATE frame confirms the link
+		if(!_serial->SetBaudRate(BAUD_RATE_V2)){
+			LOG.error("Could not switch to %d baud!", BAUD_RATE_V2);
+		}
+	}
+	_decoder = FrameDecoder();
+	_pressTime.assign(_numButtons+1, 0);
+	_pressed.assign(_numButtons+1, false);
+	// confirms the link (v2) and turns the led off again (HELLO bytes are taken for active states by v1)
+	char state[FRAME_MAX_SIZE];
+	_serial->WriteData(state, encodeState(state));
+	_lastStateSent = getMonotonicMicros();
+	_stateDirty = false;
+	return _version;
+}
+
+void DeckLink::addPress(int button_id, std::vector<ButtonEvent> & events)
+{
+	ButtonEvent e;
+	e.id = button_id;
+	e.edge = EDGE_PRESS;
+	e.deviceTime = static_cast<unsigned int>(getMonotonicMicros());
+	e.holdTime = 0;
+	events.push_back(e);
+	e.edge = EDGE_RELEASE;
+	events.push_back(e);
+}
+
+bool DeckLink::decode(const char * data, int length, std::vector<ButtonEvent> & events)
+{
+	if(_version == PROTOCOL_V1){
+		for(int i = 0; i < length; i++){
+			int button_id = static_cast<unsigned char>(data[i]);
+			if(_magicWords.feed(data[i])){
+				// arduino was reset or lost the connection and repeats the handshake
+				LOG.write(LOG_DECK, _deckID, -1, "Stream deck announced itself again, reconnecting...");
+				if(!_serial->WriteData(MAGIC_WORDS, strlen(MAGIC_WORDS))){
+					LOG.write(LOG_ERROR, _deckID, -1, "Could not send data!");
+				}
+			}
+			else if(button_id > _numButtons){
+				if(!_magicWords.inProgress()){
+					LOG.write(LOG_INVALID, _deckID, -1, "Invalid button id %d!", button_id);
+				}
+			}
+			else if(button_id != 0){
+				addPress(button_id, events);
+			}
+		}
+		return true;
+	}
+
+	Frame frame;
+	for(int i = 0; i < length; i++){
+		if(!_decoder.feed(static_cast<unsigned char>(data[i]), frame)){
+			continue;
+		}
+		if((frame.type != FRAME_BUTTON || frame.length < 1) && (frame.type != FRAME_EVENT || frame.length < EVENT_PAYLOAD_SIZE)){
+			continue;
+		}
+		if(frame.seq != _rxNext){
+			// retransmission of a frame already received, or a gap the deck will fill by resending
+			if(static_cast<unsigned char>(_rxNext - frame.seq) <= 128){
+				_duplicates++;
+			}
+			continue;
+		}
+		_rxNext++;
+		_stateDirty = true; // acknowledge
+		int button_id = frame.payload[0];
+		if(button_id == 0 || button_id > _numButtons){
+			LOG.write(LOG_INVALID, _deckID, -1, "Invalid button id %d!", button_id);
+		}
+		else if(frame.type == FRAME_BUTTON){
+			addPress(button_id, events);
+		}
+		else{
+			ButtonEvent e;
+			e.id = button_id;
+			e.edge = frame.payload[1];
+			e.deviceTime = frame.payload[2] | (frame.payload[3] << 8) | (frame.payload[4] << 16) | (static_cast<unsigned int>(frame.payload[5]) << 24);
+			e.holdTime = 0;
+			if(e.edge == EDGE_PRESS){
+				_pressTime[button_id] = e.deviceTime;
+				_pressed[button_id] = true;
+				events.push_back(e);
+			}
+			else if(e.edge == EDGE_RELEASE && _pressed[button_id]){
+				// unsigned difference survives the wrap of the device clock
+				e.holdTime = static_cast<int>((e.deviceTime - _pressTime[button_id])/1000);
+				_pressed[button_id] = false;
+				events.push_back(e);
+			}
+		}
+	}
+	// garbage only, e.g. the arduino was reset and talks at BAUD_RATE_V1 again
+	return _decoder.getConsecutiveErrors() < FRAME_DECODE_ERROR_LIMIT;
+}
+
+void DeckLink::setActive(bool active)
+{
+	if(active != _active){
+		_active = active;
+		_stateDirty = true;
+	}
+}
+
+int DeckLink::encodeState(char * out)
+{
+	if(_version == PROTOCOL_V1){
+		out[0] = _active ? 1 : 0;
+		return 1;
+	}
+	unsigned char payload[2] = {static_cast<unsigned char>(_active ? 1 : 0), static_cast<unsigned char>(_rxNext-1)};
+	return encodeFrame(reinterpret_cast<unsigned char*>(out), _txSeq++, FRAME_STATE, payload, sizeof(payload));
+}
+
+void DeckLink::setLeds(const unsigned char * bitmap)
+{
+	if(!hasLeds()){
+		return;
+	}
+	int size = (_numButtons+7)/8;
+	for(int i = 0; i < size; i++){
+		if(bitmap[i] != _leds[i]){
+			_leds[i] = bitmap[i];
+			_ledsDirty |= 1 << (i/LED_FRAME_BYTES);
+		}
+	}
+}
+
+// FRAME_LEDS with part of the bitmap (LED_FRAME_BYTES each)
+int DeckLink::encodeLeds(char * out, int part)
+{
+	int offset = part*LED_FRAME_BYTES;
+	int size = (_numButtons+7)/8 - offset;
+	if(size > LED_FRAME_BYTES){
+		size = LED_FRAME_BYTES;
+	}
+	unsigned char payload[FRAME_MAX_PAYLOAD];
+	payload[0] = static_cast<unsigned char>(offset);
+	memcpy(payload+1, _leds+offset, size);
+	return encodeFrame(reinterpret_cast<unsigned char*>(out), _txSeq++, FRAME_LEDS, payload, size+1);
+}
+
+bool DeckLink::flushState()
+{
+	ULONGLONG now = getMonotonicMicros();
+	bool send_state = _stateDirty || now - _lastStateSent >= MILLIS_TO_MICROS(KEEPALIVE_INTERVAL);
+	if(!send_state && _ledsDirty == 0){
+		return _serial->IsConnected();
+	}
+	// previous write still in progress, the newer state follows once it is done
+	if(!_serial->IsWriteComplete()){
+		return _serial->IsConnected();
+	}
+	char buffer[SERIAL_WRITE_BUFFER_SIZE];
+	int size = send_state ? encodeState(buffer) : 0;
+	// leds only go out when they changed, parts that do not fit follow with the next write
+	for(int part = 0; _ledsDirty != 0 && size + FRAME_MAX_SIZE <= SERIAL_WRITE_BUFFER_SIZE; part++){
+		if(_ledsDirty & (1 << part)){
+			size += encodeLeds(buffer+size, part);
+			_ledsDirty &= ~(1 << part);
+		}
+	}
+	if(!_serial->WriteAsync(buffer, size)){
+		return false;
+	}
+	if(send_state){
+		_lastStateSent = now;
+		_stateDirty = false;
+	}
+	return true;
+}
+
+ULONGLONG DeckLink::getFlushDeadline()
+{
+	if(_stateDirty || _ledsDirty != 0){
+		// waiting for a pending write to complete
+		return getMonotonicMicros() + MILLIS_TO_MICROS(1);
+	}
+	return _lastStateSent + MILLIS_TO_MICROS(KEEPALIVE_INTERVAL);
+}
+
+bool DeckLink::sendFrame(unsigned char type, const unsigned char * payload, int length)
+{
+	unsigned char buffer[FRAME_MAX_SIZE];
+	int size = encodeFrame(buffer, _txSeq++, type, payload, length);
+	return _serial->WriteData(reinterpret_cast<const char*>(buffer), size);
+}
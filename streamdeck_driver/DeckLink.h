@@ -0,0 +1,93 @@
+#ifndef DECKLINK_H
+#define DECKLINK_H
+
+#include "SerialCom.h"
+#include "Protocol.h"
+#include "Clock.h"
+#include <vector>
+
+// button edge received from the deck
+struct ButtonEvent{
+	int id;
+	int edge; // EDGE_PRESS or EDGE_RELEASE
+	unsigned int deviceTime; // (us, wraps) time the deck saw the edge (receive time if the deck does not send events)
+	int holdTime; // (ms) time the button was held as measured by the deck (release only)
+};
+
+#define KEEPALIVE_INTERVAL (CONNECTION_LOST_TIMEOUT/4) // (ms) resend unchanged state this often so the arduino keeps the connection
+
+// host side of the connection to the deck, speaks the protocol version
+// negotiated after the handshake (v2 frames or raw v1 bytes)
+class DeckLink{
+public:
+	DeckLink(Serial * serial);
+
+	// ask the deck for protocol v2 (magic words must have been sent back already),
+	// falls back to v1 if the firmware does not answer, returns the version in use
+	int negotiate();
+
+	int getVersion(){return _version;}
+
+	// number of buttons reported by the deck
+	int getNumButtons(){return _numButtons;}
+
+	// id reported by the deck, selects its section of the configuration
+	int getDeckID(){return _deckID;}
+
+	// deck reports releases with timestamps (DECK_FEATURE_EVENTS)
+	bool hasEvents(){return (_features & DECK_FEATURE_EVENTS) != 0;}
+
+	// deck shows the busy state of each button (DECK_FEATURE_LEDS, v2 only)
+	bool hasLeds(){return _version == PROTOCOL_V2 && (_features & DECK_FEATURE_LEDS) != 0;}
+
+	// decode received bytes, button edges are appended to events (a deck without DECK_FEATURE_EVENTS
+	// only reports presses, each is followed by a release with holdTime 0), returns false if the stream
+	// became unreadable and the link has to be reestablished
+	bool decode(const char * data, int length, std::vector<ButtonEvent> & events);
+
+	// set the active state, it is sent by the next flushState()
+	void setActive(bool active);
+
+	// set the busy bitmap (LED_BITMAP_SIZE bytes, bit id-1 for button id), the parts that changed are sent
+	// by the next flushState(). Ignored by decks without leds
+	void setLeds(const unsigned char * bitmap);
+
+	// send the state if it changed, button frames need to be acknowledged (v2) or the keepalive is due,
+	// together with the changed parts of the busy bitmap, writes do not block. Returns false if the connection was lost
+	bool flushState();
+
+	// monotonic time (micros) at which flushState() has to be called again
+	ULONGLONG getFlushDeadline();
+
+	// number of corrupted v2 frames / bytes dropped
+	unsigned long getErrors(){return _decoder.getErrors();}
+
+	// number of retransmitted button frames that were already received
+	unsigned long getDuplicates(){return _duplicates;}
+
+private:
+	bool sendFrame(unsigned char type, const unsigned char * payload, int length);
+	void addPress(int button_id, std::vector<ButtonEvent> & events);
+	int encodeState(char * out);
+	int encodeLeds(char * out, int part);
+
+	Serial * _serial;
+	int _version;
+	int _numButtons;
+	int _deckID;
+	int _features;
+	std::vector<unsigned int> _pressTime; // device time of the last press of each button (by id)
+	std::vector<bool> _pressed; // by id, releases of buttons whose press was not received are dropped
+	FrameDecoder _decoder;
+	MagicWordMatcher _magicWords;
+	unsigned char _txSeq; // sequence number of next frame sent
+	unsigned char _rxNext; // sequence number of next button frame expected from the deck
+	unsigned long _duplicates;
+	bool _active;
+	bool _stateDirty; // state changed or acknowledgement pending since the last write
+	ULONGLONG _lastStateSent; // monotonic micros
+	unsigned char _leds[LED_BITMAP_SIZE]; // busy bitmap as last set
+	unsigned int _ledsDirty; // bit per LED_FRAME_BYTES part of _leds that changed since it was sent
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "Discovery.h"
+#include "Log.h"
+#include "Protocol.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+// shared between discoverDecks() and the probe threads, outlives discoverDecks() if probes are still blocked in open
+struct ProbeState{
+	ProbeState(int n, DeckFound f, void * c): found(f), context(c), numFound(0), pending(n), inCallback(0), finished(false){}
+	std::mutex mutex;
+	std::condition_variable done;
+	DeckFound found;
+	void * context;
+	int numFound;
+	int pending; // probes still running
+	int inCallback; // probes that are handing over a deck
+	bool finished; // discoverDecks() stopped waiting, late probes close their ports
+};
+
+static void probePort(std::shared_ptr<ProbeState> state, std::string port, Clock::time_point deadline)
+{
+	Serial * sp = Serial::Open(port.c_str());
+	MagicWordMatcher matcher;
+	char buffer[64];
+	bool found = false;
+
+	// collect the magic words, they might arrive in several pieces or after other data
+	// when the arduino was not reset by opening the port and is repeating its handshake
+	while(sp->IsConnected() && !found && Clock::now() < deadline){
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if(state->finished)
+				break;
+		}
+		int bytes_read = sp->ReadData(buffer, sizeof(buffer), DISCOVERY_READ_SLICE);
+		for(int i = 0; i < bytes_read && !found; i++){
+			found = matcher.feed(buffer[i]);
+		}
+	}
+
+	bool accepted;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		accepted = found && !state->finished;
+		if(accepted){
+			state->numFound++;
+			state->inCallback++;
+		}
+	}
+	if(accepted){
+		// send magic word back
+		if(!sp->WriteData(MAGIC_WORDS, strlen(MAGIC_WORDS))){
+			LOG.error("Could not send data to %s!", port.c_str());
+		}
+		// decks found at the same time are handed over in parallel
+		state->found(sp, port, state->context);
+	}
+	else{
+		delete sp;
+	}
+
+	std::lock_guard<std::mutex> lock(state->mutex);
+	if(accepted)
+		state->inCallback--;
+	state->pending--;
+	state->done.notify_all();
+}
+
+int discoverDecks(const std::vector<std::string> & candidates, int timeout_ms, DeckFound found, void * context)
+{
+	if(candidates.empty())
+		return 0;
+
+	Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+	std::shared_ptr<ProbeState> state(new ProbeState(static_cast<int>(candidates.size()), found, context));
+	for(unsigned int i = 0; i < candidates.size(); i++){
+		std::thread(probePort, state, candidates[i], deadline).detach();
+	}
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	// opening a port is not interruptible, give blocked probes a little extra time
+	state->done.wait_until(lock, deadline + std::chrono::milliseconds(DISCOVERY_READ_SLICE), [&state]{
+		return state->pending == 0;
+	});
+	// remaining probes close their ports, decks that were found are always handed over before returning
+	state->finished = true;
+	state->done.wait(lock, [&state]{
+		return state->inCallback == 0;
+	});
+	return state->numFound;
+}
+
+bool loadCachedPorts(const char * cache_path, std::vector<std::string> & ports)
+{
+	FILE * f = fopen(cache_path, "r");
+	if(!f)
+		return false;
+	char line[260];
+	while(fgets(line, sizeof(line), f) != NULL){
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] != '\0')
+			ports.push_back(line);
+	}
+	fclose(f);
+	return !ports.empty();
+}
+
+void saveCachedPorts(const char * cache_path, const std::vector<std::string> & ports)
+{
+	FILE * f = fopen(cache_path, "w");
+	if(!f){
+		LOG.error("Could not write %s", cache_path);
+		return;
+	}
+	for(unsigned int i = 0; i < ports.size(); i++){
+		fprintf(f, "%s\n", ports[i].c_str());
+	}
+	fclose(f);
+}
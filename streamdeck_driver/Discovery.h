@@ -0,0 +1,24 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include "SerialCom.h"
+#include <string>
+#include <vector>
+
+#define DISCOVERY_TIMEOUT (ARDUINO_WAIT_TIME+1000)	// (ms) how long to wait for the magic words after opening a port (includes arduino reset)
+#define DISCOVERY_READ_SLICE 50						// (ms) probes check whether another port already answered at least this often
+#define PORT_CACHE_FILE "streamdeck_port.txt"		// ports decks were found on last time, one per line (in the user's profile directory)
+
+// called on a probe thread for every port a deck answered on (magic words already sent back),
+// the callback takes ownership of serial
+typedef void (*DeckFound)(Serial * serial, const std::string & port, void * context);
+
+// open all candidate ports at the same time and wait for the magic words on each of them, found is called
+// as soon as a port answers. Returns the number of decks found once all probes answered or timed out
+int discoverDecks(const std::vector<std::string> & candidates, int timeout_ms, DeckFound found, void * context);
+
+// read/write ports decks were found on, cache_path is the full path of the cache file
+bool loadCachedPorts(const char * cache_path, std::vector<std::string> & ports);
+void saveCachedPorts(const char * cache_path, const std::vector<std::string> & ports);
+
+#endif
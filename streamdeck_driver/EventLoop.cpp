@@ -0,0 +1,203 @@
+#include "EventLoop.h"
+#include "Log.h"
+#include <algorithm>
+
+#ifdef _WIN32
+
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+EventLoop::EventLoop(): _raisedTimerResolution(false)
+{
+	_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	// high resolution timers are not affected by the 15.6ms system tick (Windows 10 1803+)
+	_timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if(_timer == NULL){
+		// older systems: raise the system tick to 1ms while the loop exists so delays stay accurate
+		_timer = CreateWaitableTimer(NULL, TRUE, NULL);
+		_raisedTimerResolution = (timeBeginPeriod(1) == TIMERR_NOERROR);
+	}
+}
+
+EventLoop::~EventLoop()
+{
+	if(_raisedTimerResolution){
+		timeEndPeriod(1);
+	}
+	if(_timer != NULL){
+		CloseHandle(_timer);
+	}
+	CloseHandle(_wake);
+}
+
+void EventLoop::add(Serial * serial)
+{
+	_serials.push_back(serial);
+}
+
+void EventLoop::remove(Serial * serial)
+{
+	_serials.erase(std::remove(_serials.begin(), _serials.end(), serial), _serials.end());
+}
+
+void EventLoop::wake()
+{
+	SetEvent(_wake);
+}
+
+int EventLoop::wait(ULONGLONG deadline)
+{
+	for(unsigned int i = 0; i < _serials.size(); i++){
+		if(_serials[i]->ArmReadyHandle()){
+			return EVENT_SERIAL;
+		}
+	}
+	ULONGLONG now = getMonotonicMicros();
+	if(deadline <= now){
+		return EVENT_TIMEOUT;
+	}
+
+	// wake event, serial ports, timer (WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles)
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	DWORD num_handles = 0;
+	handles[num_handles++] = _wake;
+	for(unsigned int i = 0; i < _serials.size() && num_handles < MAXIMUM_WAIT_OBJECTS-1; i++){
+		handles[num_handles++] = _serials[i]->GetReadyHandle();
+	}
+	if(deadline != DEADLINE_NONE){
+		// waitable timers run on the interrupt time, not on QPC, so the deadline is converted to
+		// a relative due time right before waiting (negative, in 100ns units)
+		LARGE_INTEGER due;
+		due.QuadPart = -10LL*static_cast<LONGLONG>(deadline - now);
+		SetWaitableTimer(_timer, &due, 0, NULL, NULL, FALSE);
+		handles[num_handles++] = _timer;
+	}
+
+	DWORD result = WaitForMultipleObjects(num_handles, handles, FALSE, INFINITE);
+	if(deadline != DEADLINE_NONE){
+		CancelWaitableTimer(_timer);
+	}
+	if(result == WAIT_OBJECT_0){
+		return EVENT_WAKE;
+	}
+	if(result < WAIT_OBJECT_0+num_handles){
+		return (deadline != DEADLINE_NONE && result == WAIT_OBJECT_0+num_handles-1) ? EVENT_TIMEOUT : EVENT_SERIAL;
+	}
+	LOG.error("Failed to wait for events: 0x%x", HRESULT_FROM_WIN32(GetLastError()));
+	return EVENT_NONE;
+}
+
+#else // Linux
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+EventLoop::EventLoop()
+{
+	_epoll = epoll_create1(EPOLL_CLOEXEC);
+	_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EVENT_TIMEOUT;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _timer, &ev);
+	ev.data.u32 = EVENT_WAKE;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &ev);
+}
+
+EventLoop::~EventLoop()
+{
+	close(_wake);
+	close(_timer);
+	close(_epoll);
+}
+
+void EventLoop::add(Serial * serial)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EVENT_SERIAL;
+	epoll_ctl(_epoll, EPOLL_CTL_ADD, serial->GetReadyHandle(), &ev);
+	_serials.push_back(serial);
+}
+
+void EventLoop::remove(Serial * serial)
+{
+	epoll_ctl(_epoll, EPOLL_CTL_DEL, serial->GetReadyHandle(), NULL);
+	_serials.erase(std::remove(_serials.begin(), _serials.end(), serial), _serials.end());
+}
+
+void EventLoop::wake()
+{
+	uint64_t one = 1;
+	if(write(_wake, &one, sizeof(one)) < 0){
+		// counter is already signaled
+	}
+}
+
+int EventLoop::wait(ULONGLONG deadline)
+{
+	for(unsigned int i = 0; i < _serials.size(); i++){
+		if(_serials[i]->ArmReadyHandle()){
+			return EVENT_SERIAL;
+		}
+	}
+	if(deadline <= getMonotonicMicros()){
+		return EVENT_TIMEOUT;
+	}
+
+	// the timer runs on CLOCK_MONOTONIC just like getMonotonicMicros, so the deadline is used as is
+	struct itimerspec t;
+	memset(&t, 0, sizeof(t));
+	if(deadline != DEADLINE_NONE){
+		t.it_value.tv_sec = deadline/1000000;
+		t.it_value.tv_nsec = (deadline%1000000)*1000L;
+		timerfd_settime(_timer, TFD_TIMER_ABSTIME, &t, NULL);
+	}
+
+	struct epoll_event events[16];
+	int n;
+	do{
+		n = epoll_wait(_epoll, events, 16, -1);
+	}while(n < 0 && errno == EINTR);
+
+	int result = EVENT_NONE;
+	for(int i = 0; i < n; i++){
+		result |= events[i].data.u32;
+	}
+	if(result & EVENT_WAKE){
+		uint64_t count;
+		if(read(_wake, &count, sizeof(count)) < 0){
+			// already drained
+		}
+	}
+	if(result & EVENT_TIMEOUT){
+		uint64_t expirations;
+		if(read(_timer, &expirations, sizeof(expirations)) < 0){
+			// already drained
+		}
+	}
+	else if(deadline != DEADLINE_NONE){
+		// disarm
+		memset(&t, 0, sizeof(t));
+		timerfd_settime(_timer, 0, &t, NULL);
+	}
+	if(n < 0){
+		LOG.error("Failed to wait for events: %s", strerror(errno));
+	}
+	return result;
+}
+
+#endif
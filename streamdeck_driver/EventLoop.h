@@ -0,0 +1,45 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include "Platform.h"
+#include "SerialCom.h"
+#include "Clock.h"
+#include <vector>
+
+#define EVENT_NONE		0x00
+#define EVENT_SERIAL	0x01 // data from one of the serial ports is available
+#define EVENT_TIMEOUT	0x02 // timeout expired
+#define EVENT_WAKE		0x04 // wake() was called
+
+// blocks until one of the serial ports has data, a timeout expires or another thread calls wake(),
+// backed by WaitForMultipleObjects + waitable timer + event (Win32) or epoll + timerfd + eventfd (Linux)
+class EventLoop{
+public:
+	EventLoop();
+	~EventLoop();
+
+	// watch serial for data (the serial must be removed before it is deleted)
+	void add(Serial * serial);
+	void remove(Serial * serial);
+
+	// wait until data is available on any serial port or the monotonic clock (getMonotonicMicros) reached deadline
+	// (DEADLINE_NONE to wait for data only), returns combination of EVENT_SERIAL/EVENT_TIMEOUT/EVENT_WAKE
+	int wait(ULONGLONG deadline);
+
+	// let wait() return (can be called from any thread)
+	void wake();
+
+private:
+	std::vector<Serial*> _serials;
+#ifdef _WIN32
+	HANDLE _timer;
+	HANDLE _wake;
+	bool _raisedTimerResolution; // timeBeginPeriod(1) is in effect
+#else
+	int _epoll;
+	int _timer;
+	int _wake;
+#endif
+};
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef _WIN32
+
+#include "FakeDeck.h"
+#include "Protocol.h"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+static long long nowMillis()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static long long nowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FakeDeck::FakeDeck(int boot_time_ms, int max_version, int deck_id, int num_buttons):
+	_bootTime(boot_time_ms), _maxVersion(max_version), _deckID(deck_id), _numButtons(num_buttons), _master(-1), _running(false), _connected(false), _active(false),
+	_bytesReceived(0), _version(PROTOCOL_V1), _ledFrames(0), _printLeds(false), _txSeq(0), _lastActiveReceived(0), _lastSend(0)
+{
+	memset(_leds, 0, sizeof(_leds));
+	_wakeup[0] = _wakeup[1] = -1;
+	_portName[0] = '\0';
+	_debounce.assign(num_buttons, 0);
+	_scanTime.assign(num_buttons, 0);
+}
+
+FakeDeck::~FakeDeck()
+{
+	stop();
+}
+
+bool FakeDeck::start()
+{
+	_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(_master < 0 || grantpt(_master) != 0 || unlockpt(_master) != 0){
+		fprintf(stderr, "Failed to create pseudo terminal: %s\n", strerror(errno));
+		return false;
+	}
+	snprintf(_portName, sizeof(_portName), "%s", ptsname(_master));
+
+	// raw on the device side, the driver configures its end of the line
+	struct termios tty;
+	tcgetattr(_master, &tty);
+	cfmakeraw(&tty);
+	tcsetattr(_master, TCSANOW, &tty);
+
+	// open and close the slave once so the master reports POLLHUP until the driver opens the port
+	int slave = open(_portName, O_RDWR | O_NOCTTY);
+	if(slave >= 0){
+		close(slave);
+	}
+
+	if(pipe(_wakeup) != 0){
+		return false;
+	}
+	fcntl(_wakeup[0], F_SETFL, O_NONBLOCK);
+
+	_running = true;
+	_thread = std::thread(&FakeDeck::run, this);
+	return true;
+}
+
+void FakeDeck::stop()
+{
+	if(_running){
+		_running = false;
+		char c = 0;
+		if(write(_wakeup[1], &c, 1) < 0){
+			// thread notices _running on next timeout
+		}
+		_thread.join();
+	}
+	if(_wakeup[0] >= 0){
+		close(_wakeup[0]);
+		close(_wakeup[1]);
+		_wakeup[0] = _wakeup[1] = -1;
+	}
+	if(_master >= 0){
+		close(_master);
+		_master = -1;
+	}
+}
+
+void FakeDeck::press(int button_id, int hold_ms)
+{
+	Press p;
+	p.id = button_id;
+	p.hold = hold_ms;
+	p.time = nowMicros();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pending.push_back(p);
+	}
+	char c = 0;
+	if(write(_wakeup[1], &c, 1) < 0){
+		fprintf(stderr, "Failed to wake up fake deck: %s\n", strerror(errno));
+	}
+}
+
+void FakeDeck::sendPending()
+{
+	std::vector<Press> pending;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		pending.swap(_pending);
+	}
+	if(!_connected){
+		// like the sketch, buttons are ignored while not connected
+		return;
+	}
+	for(unsigned int i = 0; i < pending.size(); i++){
+		const Press & p = pending[i];
+		long long hold = p.hold*1000LL > FAKE_DECK_HOLD_TIME ? p.hold*1000LL : FAKE_DECK_HOLD_TIME;
+		if(!scanPress(p.id-1, p.time, hold))
+			continue;
+		sendEvent(static_cast<unsigned char>(p.id), EDGE_PRESS, p.time);
+		Release r;
+		r.id = p.id;
+		r.time = p.time + hold;
+		unsigned int pos = 0;
+		while(pos < _releases.size() && _releases[pos].time <= r.time)
+			pos++;
+		_releases.insert(_releases.begin() + pos, r);
+	}
+}
+
+void FakeDeck::sendReleases(long long now)
+{
+	while(!_releases.empty() && _releases[0].time <= now){
+		sendEvent(static_cast<unsigned char>(_releases[0].id), EDGE_RELEASE, _releases[0].time);
+		_releases.erase(_releases.begin());
+	}
+}
+
+// feed the raw level of button index to the debouncer for duration (us) of simulated time, one sample per tick
+void FakeDeck::sample(int index, bool pressed, long long duration)
+{
+	long long & t = _scanTime[index];
+	long long end = t + duration;
+	do{
+		long long next = (t/DEBOUNCE_TICK + 1)*DEBOUNCE_TICK;
+		debounce(&_debounce[index], pressed, 1);
+		t = next < end ? next : end;
+	}while(t < end);
+}
+
+// simulate the contact of button index closing at now (us) with bounces, being held for hold (us) and opening again,
+// returns true if the debouncer reported the press
+bool FakeDeck::scanPress(int index, long long now, long long hold)
+{
+	if(_scanTime[index] < now){
+		// contact was open since the last press, a sample per tick lets the integrator drain
+		long long idle = now - _scanTime[index];
+		if(idle > DEBOUNCE_TICK*(DEBOUNCE_RELEASE_TICKS+1))
+			idle = DEBOUNCE_TICK*(DEBOUNCE_RELEASE_TICKS+1);
+		sample(index, false, idle);
+		_scanTime[index] = now;
+	}
+	bool pressed = false;
+	for(int i = 0; i < FAKE_DECK_BOUNCES; i++){
+		pressed = debounce(&_debounce[index], 1, 0) || pressed;
+		sample(index, false, FAKE_DECK_BOUNCE_TIME);
+	}
+	pressed = debounce(&_debounce[index], 1, 0) || pressed;
+	sample(index, true, hold);
+	for(int i = 0; i < FAKE_DECK_BOUNCES; i++){
+		sample(index, false, FAKE_DECK_BOUNCE_TIME);
+		sample(index, true, FAKE_DECK_BOUNCE_TIME);
+	}
+	return pressed;
+}
+
+void FakeDeck::sendEvent(unsigned char button_id, unsigned char edge, long long time)
+{
+	if(_version == PROTOCOL_V1){
+		// old firmware only knows presses
+		if(edge == EDGE_PRESS && write(_master, &button_id, 1) != 1){
+			fprintf(stderr, "Fake deck failed to send button %d\n", button_id);
+		}
+		return;
+	}
+	if(_unackedSeq.size() >= RESEND_QUEUE_SIZE){
+		// oldest event is lost
+		_unackedSeq.erase(_unackedSeq.begin());
+		_unackedEvents.erase(_unackedEvents.begin());
+	}
+	Event e;
+	e.payload[0] = button_id;
+	e.payload[1] = edge;
+	for(int i = 0; i < 4; i++){
+		e.payload[2+i] = static_cast<unsigned char>(time >> (8*i));
+	}
+	_unackedSeq.push_back(_txSeq);
+	_unackedEvents.push_back(e);
+	sendFrame(_txSeq++, FRAME_EVENT, e.payload, EVENT_PAYLOAD_SIZE);
+	_lastSend = nowMillis();
+}
+
+void FakeDeck::sendFrame(unsigned char seq, unsigned char type, const unsigned char * payload, int length)
+{
+	unsigned char buffer[FRAME_MAX_SIZE];
+	int size = encodeFrame(buffer, seq, type, payload, length);
+	if(write(_master, buffer, size) != size){
+		fprintf(stderr, "Fake deck failed to send frame\n");
+	}
+}
+
+void FakeDeck::resendUnacked()
+{
+	if(_unackedSeq.empty() || nowMillis() - _lastSend < RESEND_TIMEOUT){
+		return;
+	}
+	for(unsigned int i = 0; i < _unackedSeq.size(); i++){
+		sendFrame(_unackedSeq[i], FRAME_EVENT, _unackedEvents[i].payload, EVENT_PAYLOAD_SIZE);
+	}
+	_lastSend = nowMillis();
+}
+
+// magic word sent back is correct -> connect (v1 until the host asks for more)
+void FakeDeck::connect()
+{
+	unsigned char zer0 = 0;
+	if(write(_master, &zer0, 1) != 1){
+		return;
+	}
+	_connected = true;
+	_version = PROTOCOL_V1;
+	_bytesReceived = 0;
+	_decoder = FrameDecoder();
+	_txSeq = 0;
+	_unackedSeq.clear();
+	_unackedEvents.clear();
+	_releases.clear();
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		memset(_leds, 0, sizeof(_leds));
+	}
+	_lastActiveReceived = nowMillis();
+	// like the sketch: buttons held while connecting only count after they were released
+	_debounce.assign(_numButtons, DEBOUNCE_RELEASE_TICKS);
+	_scanTime.assign(_numButtons, 0);
+}
+
+// bytes received from the host while connected
+void FakeDeck::receive(const char * data, int length)
+{
+	Frame frame;
+	for(int i = 0; i < length; i++){
+		_bytesReceived++;
+		unsigned char c = static_cast<unsigned char>(data[i]);
+		if(_version == PROTOCOL_V1 && (c == 0 || c == 1)){
+			_active = (c != 0);
+			_lastActiveReceived = nowMillis();
+		}
+		if(!_decoder.feed(c, frame)){
+			continue;
+		}
+		if(frame.type == FRAME_HELLO && frame.length >= 2 && _version == PROTOCOL_V1 && _maxVersion >= PROTOCOL_V2 && frame.payload[0] >= PROTOCOL_V2){
+			unsigned char ack[4] = {PROTOCOL_V2, static_cast<unsigned char>(_numButtons), static_cast<unsigned char>(_deckID),
+				DECK_FEATURE_EVENTS | DECK_FEATURE_LEDS};
+			sendFrame(_txSeq++, FRAME_HELLO_ACK, ack, sizeof(ack));
+			// the sketch switches to BAUD_RATE_V2 here, a pty does not care
+			_version = PROTOCOL_V2;
+		}
+		else if(frame.type == FRAME_STATE && frame.length >= 2 && _version == PROTOCOL_V2){
+			_active = (frame.payload[0] != 0);
+			_lastActiveReceived = nowMillis();
+			// drop acknowledged button frames
+			unsigned char ack = frame.payload[1];
+			while(!_unackedSeq.empty() && static_cast<unsigned char>(ack - _unackedSeq[0]) < 128){
+				_unackedSeq.erase(_unackedSeq.begin());
+				_unackedEvents.erase(_unackedEvents.begin());
+			}
+		}
+		else if(frame.type == FRAME_LEDS && frame.length >= 1 && _version == PROTOCOL_V2){
+			setLeds(frame);
+		}
+	}
+}
+
+bool FakeDeck::isLedOn(int button_id)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return (_leds[(button_id-1)/8] >> ((button_id-1)%8)) & 1;
+}
+
+// like the sketch: the bytes of the frame replace the bitmap from their offset on
+void FakeDeck::setLeds(const Frame & frame)
+{
+	_ledFrames++;
+	std::string on;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for(int i = 1; i < frame.length && frame.payload[0]+i-1 < LED_BITMAP_SIZE; i++){
+			_leds[frame.payload[0]+i-1] = frame.payload[i];
+		}
+		if(!_printLeds)
+			return;
+		for(int id = 1; id <= _numButtons; id++){
+			if((_leds[(id-1)/8] >> ((id-1)%8)) & 1)
+				on += " " + std::to_string(id);
+		}
+	}
+	printf("Leds:%s\n", on.empty() ? " off" : on.c_str());
+	fflush(stdout);
+}
+
+void FakeDeck::run()
+{
+	enum {WAIT_FOR_HOST, HANDSHAKE, CONNECTED} state = WAIT_FOR_HOST;
+	long long last_handshake_sent = 0;
+	MagicWordMatcher matcher;
+	char buffer[256];
+
+	while(_running){
+		struct pollfd p[2] = {{_wakeup[0], POLLIN, 0}, {_master, POLLIN, 0}};
+		long long now = nowMillis();
+		long long timeout = 10;
+		if(state == CONNECTED){
+			timeout = _lastActiveReceived + CONNECTION_LOST_TIMEOUT - now;
+			if(!_unackedSeq.empty() && _lastSend + RESEND_TIMEOUT - now < timeout){
+				timeout = _lastSend + RESEND_TIMEOUT - now;
+			}
+			if(!_releases.empty()){
+				long long release = (_releases[0].time + 999)/1000 - now;
+				if(release < timeout)
+					timeout = release;
+			}
+		}
+		else if(state == HANDSHAKE){
+			timeout = last_handshake_sent + HANDSHAKE_INTERVAL - now;
+		}
+		if(timeout < 0)
+			timeout = 0;
+		// a master without attached slave reports POLLHUP permanently, so only
+		// poll the wake up pipe while waiting for the driver to open the port
+		poll(p, state == WAIT_FOR_HOST ? 1 : 2, static_cast<int>(timeout));
+
+		if(p[0].revents & POLLIN){
+			while(read(_wakeup[0], buffer, sizeof(buffer)) > 0){}
+			sendPending();
+		}
+
+		if(state == WAIT_FOR_HOST){
+			poll(&p[1], 1, 0);
+			if(!(p[1].revents & POLLHUP)){
+				// opening the port resets the arduino
+				usleep(_bootTime*1000);
+				state = HANDSHAKE;
+				last_handshake_sent = 0;
+			}
+			continue;
+		}
+		if(p[1].revents & POLLHUP){
+			// port closed by the driver
+			state = WAIT_FOR_HOST;
+			_connected = false;
+			_active = false;
+			continue;
+		}
+
+		if(p[1].revents & POLLIN){
+			ssize_t n = read(_master, buffer, sizeof(buffer));
+			if(state == CONNECTED && n > 0){
+				receive(buffer, n);
+			}
+			for(ssize_t i = 0; state == HANDSHAKE && i < n; i++){
+				if(matcher.feed(buffer[i])){
+					connect();
+					if(_connected){
+						state = CONNECTED;
+						// rest of the data belongs to the connection
+						receive(buffer+i+1, n-i-1);
+					}
+				}
+			}
+		}
+
+		now = nowMillis();
+		if(state == CONNECTED && now - _lastActiveReceived >= CONNECTION_LOST_TIMEOUT){
+			// host is gone, wait until it comes back
+			state = HANDSHAKE;
+			_connected = false;
+			_active = false;
+			_version = PROTOCOL_V1;
+			last_handshake_sent = 0;
+			matcher = MagicWordMatcher();
+		}
+		if(state == CONNECTED){
+			sendReleases(nowMicros());
+			resendUnacked();
+		}
+		if(state == HANDSHAKE && now - last_handshake_sent >= HANDSHAKE_INTERVAL){
+			const int magic_words_len = strlen(MAGIC_WORDS);
+			if(write(_master, MAGIC_WORDS, magic_words_len) != magic_words_len){
+				fprintf(stderr, "Fake deck failed to send magic words\n");
+			}
+			last_handshake_sent = now;
+		}
+	}
+}
+
+#endif
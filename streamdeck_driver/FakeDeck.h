@@ -0,0 +1,118 @@
+#ifndef FAKEDECK_H
+#define FAKEDECK_H
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Protocol.h"
+#include "../arduino/streamdeck_sketch/debounce.h"
+
+#define FAKE_DECK_BOOT_TIME 200			// (ms) time the fake arduino needs to 'reset' after the port was opened
+#define FAKE_DECK_BOUNCES 3				// times a simulated contact bounces when it closes and opens
+#define FAKE_DECK_BOUNCE_TIME 200		// (us) between two bounces
+#define FAKE_DECK_HOLD_TIME 5000		// (us) a simulated press holds the contact closed at least this long
+
+// emulates the arduino side of the stream deck on a pseudo terminal (Linux only),
+// the driver connects to getPortName() just like it would to a real device
+class FakeDeck{
+public:
+	// max_version: highest protocol version the emulated firmware supports (PROTOCOL_V1 for old firmware),
+	// deck_id and num_buttons are reported to the host in protocol v2
+	FakeDeck(int boot_time_ms = FAKE_DECK_BOOT_TIME, int max_version = PROTOCOL_V2, int deck_id = DEFAULT_DECK_ID,
+			int num_buttons = DEVICE_NUM_BUTTONS);
+	~FakeDeck();
+
+	// create the pseudo terminal and start the device thread
+	bool start();
+	void stop();
+
+	// path of the tty the driver has to open
+	const char * getPortName(){return _portName;}
+
+	// press button id (1..num_buttons) and release it after hold_ms, the bouncing contact is debounced
+	// like the sketch does it and both edges are sent to the host unless the button was pressed again too soon
+	void press(int button_id, int hold_ms = 0);
+
+	// handshake done and heartbeat received within CONNECTION_LOST_TIMEOUT
+	bool isConnected(){return _connected;}
+
+	// last active state received from the host (green led)
+	bool isActive(){return _active;}
+
+	// led of button id (1..num_buttons) as last set by FRAME_LEDS (group of the button busy)
+	bool isLedOn(int button_id);
+
+	// number of FRAME_LEDS received
+	unsigned long getLedFrames(){return _ledFrames;}
+
+	// print the buttons whose led is on whenever a FRAME_LEDS changes them
+	void setPrintLeds(bool print){_printLeds = print;}
+
+	// number of bytes received from the host after the handshake
+	unsigned long getBytesReceived(){return _bytesReceived;}
+
+	// protocol version negotiated with the host
+	int getVersion(){return _version;}
+
+private:
+	void run();
+	void connect();
+	void sendPending();
+	bool scanPress(int index, long long now, long long hold);
+	void sample(int index, bool pressed, long long duration);
+	void sendReleases(long long now);
+	void sendEvent(unsigned char button_id, unsigned char edge, long long time);
+	void sendFrame(unsigned char seq, unsigned char type, const unsigned char * payload, int length);
+	void receive(const char * data, int length);
+	void resendUnacked();
+	void setLeds(const Frame & frame);
+
+	int _bootTime;
+	int _maxVersion;
+	int _deckID;
+	int _numButtons;
+	int _master;
+	int _wakeup[2]; // pipe to wake up the device thread on button presses
+	char _portName[64];
+	std::thread _thread;
+	std::atomic<bool> _running;
+	std::atomic<bool> _connected;
+	std::atomic<bool> _active;
+	std::atomic<unsigned long> _bytesReceived;
+	std::atomic<int> _version;
+	std::atomic<unsigned long> _ledFrames;
+	std::atomic<bool> _printLeds;
+
+	// protocol state, only used by the device thread
+	FrameDecoder _decoder;
+	unsigned char _txSeq;
+	long long _lastActiveReceived;
+	long long _lastSend; // last time button frames were (re)sent
+	struct Event{
+		unsigned char payload[EVENT_PAYLOAD_SIZE];
+	};
+	struct Press{
+		int id;
+		int hold; // (ms)
+		long long time; // (us)
+	};
+	struct Release{
+		int id;
+		long long time; // (us) due
+	};
+	std::vector<unsigned char> _unackedSeq; // event frames not acknowledged yet (v2)
+	std::vector<Event> _unackedEvents;
+	std::vector<Release> _releases; // pressed buttons, sorted by due time
+	std::vector<debounce_t> _debounce; // integrator of each button
+	std::vector<long long> _scanTime; // (us) simulated time each button was sampled up to
+	std::mutex _mutex;
+	std::vector<Press> _pending; // presses not yet sent
+	unsigned char _leds[LED_BITMAP_SIZE]; // busy bitmap (guarded by _mutex)
+};
+
+#endif
+
+#endif
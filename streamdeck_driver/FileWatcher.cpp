@@ -0,0 +1,182 @@
+#include "FileWatcher.h"
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+FileWatcher::FileWatcher(): _onChange(NULL), _context(NULL)
+{
+#ifdef _WIN32
+	_dir = INVALID_HANDLE_VALUE;
+	_stopEvent = NULL;
+#else
+	_inotify = -1;
+	_stopPipe[0] = _stopPipe[1] = -1;
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+	stop();
+}
+
+bool FileWatcher::start(const char * path, Callback on_change, void * context)
+{
+	std::string p(path);
+	size_t separator = p.find_last_of(PATH_SEPARATOR);
+	_directory = separator == std::string::npos ? "." : p.substr(0, separator);
+	_name = separator == std::string::npos ? p : p.substr(separator+1);
+	_onChange = on_change;
+	_context = context;
+
+#ifdef _WIN32
+	_dir = CreateFileA(_directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+						NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+	if(_dir == INVALID_HANDLE_VALUE){
+		fprintf(stderr, "Could not watch %s: 0x%x\n", _directory.c_str(), HRESULT_FROM_WIN32(GetLastError()));
+		return false;
+	}
+	_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+#else
+	_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_inotify < 0 || inotify_add_watch(_inotify, _directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0){
+		fprintf(stderr, "Could not watch %s: %s\n", _directory.c_str(), strerror(errno));
+		return false;
+	}
+	if(pipe(_stopPipe) < 0){
+		return false;
+	}
+#endif
+	_thread = std::thread(&FileWatcher::run, this);
+	return true;
+}
+
+void FileWatcher::stop()
+{
+#ifdef _WIN32
+	if(_stopEvent != NULL)
+		SetEvent(_stopEvent);
+	if(_thread.joinable())
+		_thread.join();
+	if(_dir != INVALID_HANDLE_VALUE)
+		CloseHandle(_dir);
+	if(_stopEvent != NULL)
+		CloseHandle(_stopEvent);
+	_dir = INVALID_HANDLE_VALUE;
+	_stopEvent = NULL;
+#else
+	if(_stopPipe[1] >= 0){
+		char c = 0;
+		if(write(_stopPipe[1], &c, 1) < 0){
+			// thread is gone already
+		}
+	}
+	if(_thread.joinable())
+		_thread.join();
+	if(_inotify >= 0)
+		close(_inotify);
+	if(_stopPipe[0] >= 0)
+		close(_stopPipe[0]);
+	if(_stopPipe[1] >= 0)
+		close(_stopPipe[1]);
+	_inotify = -1;
+	_stopPipe[0] = _stopPipe[1] = -1;
+#endif
+}
+
+#ifdef _WIN32
+
+void FileWatcher::run()
+{
+	WCHAR name[MAX_PATH];
+	int name_length = MultiByteToWideChar(CP_ACP, 0, _name.c_str(), -1, name, MAX_PATH)-1;
+	DWORD buffer[4096]; // DWORD aligned as required by ReadDirectoryChangesW
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	HANDLE handles[2] = {_stopEvent, overlapped.hEvent};
+	bool changed = false;
+
+	while(true){
+		ResetEvent(overlapped.hEvent);
+		if(!ReadDirectoryChangesW(_dir, buffer, sizeof(buffer), FALSE,
+				FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME, NULL, &overlapped, NULL)){
+			fprintf(stderr, "Could not watch %s: 0x%x\n", _directory.c_str(), HRESULT_FROM_WIN32(GetLastError()));
+			break;
+		}
+		// report the change once no further events arrived for the settle time
+		DWORD result = WaitForMultipleObjects(2, handles, FALSE, changed ? FILE_WATCH_SETTLE_TIME : INFINITE);
+		if(result == WAIT_TIMEOUT){
+			CancelIo(_dir);
+			DWORD unused;
+			GetOverlappedResult(_dir, &overlapped, &unused, TRUE);
+			changed = false;
+			_onChange(_context);
+			continue;
+		}
+		if(result != WAIT_OBJECT_0+1){
+			CancelIo(_dir);
+			DWORD unused;
+			GetOverlappedResult(_dir, &overlapped, &unused, TRUE);
+			break;
+		}
+		DWORD bytes = 0;
+		if(!GetOverlappedResult(_dir, &overlapped, &bytes, FALSE) || bytes == 0){
+			// buffer overflow, the file might have changed
+			changed = true;
+			continue;
+		}
+		FILE_NOTIFY_INFORMATION * info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(buffer);
+		while(true){
+			if(info->Action != FILE_ACTION_REMOVED && info->Action != FILE_ACTION_RENAMED_OLD_NAME &&
+				static_cast<int>(info->FileNameLength/sizeof(WCHAR)) == name_length &&
+				_wcsnicmp(info->FileName, name, name_length) == 0){
+				changed = true;
+			}
+			if(info->NextEntryOffset == 0)
+				break;
+			info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(reinterpret_cast<char*>(info) + info->NextEntryOffset);
+		}
+	}
+	CloseHandle(overlapped.hEvent);
+}
+
+#else
+
+void FileWatcher::run()
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd fds[2];
+	fds[0].fd = _stopPipe[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = _inotify;
+	fds[1].events = POLLIN;
+	bool changed = false;
+
+	while(true){
+		// report the change once no further events arrived for the settle time
+		int n = poll(fds, 2, changed ? FILE_WATCH_SETTLE_TIME : -1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0 || (fds[0].revents & POLLIN))
+			break;
+		if(n == 0){
+			changed = false;
+			_onChange(_context);
+			continue;
+		}
+		ssize_t length = read(_inotify, buffer, sizeof(buffer));
+		for(ssize_t i = 0; i < length; ){
+			struct inotify_event * e = reinterpret_cast<struct inotify_event*>(buffer+i);
+			if(e->len > 0 && _name == e->name){
+				changed = true;
+			}
+			i += sizeof(struct inotify_event) + e->len;
+		}
+	}
+}
+
+#endif
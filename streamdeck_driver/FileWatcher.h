@@ -0,0 +1,43 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include "Platform.h"
+#include <string>
+#include <thread>
+
+#define FILE_WATCH_SETTLE_TIME 100 // (ms) editors write in several steps, wait for the file to settle before reporting a change
+
+// watches a single file for changes on a background thread,
+// backed by ReadDirectoryChangesW (Win32) or inotify (Linux) on the file's directory
+class FileWatcher{
+public:
+	// called on the watcher thread after the file was written, created or replaced
+	typedef void (*Callback)(void * context);
+
+	FileWatcher();
+	~FileWatcher();
+
+	// start watching path, return false if the directory cannot be watched
+	bool start(const char * path, Callback on_change, void * context);
+
+	// stop watching and wait for the thread
+	void stop();
+
+private:
+	void run();
+
+	std::string _directory;
+	std::string _name;
+	Callback _onChange;
+	void * _context;
+	std::thread _thread;
+#ifdef _WIN32
+	HANDLE _dir;
+	HANDLE _stopEvent;
+#else
+	int _inotify;
+	int _stopPipe[2];
+#endif
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "ForegroundWatcher.h"
+#include <stdio.h>
+#include <string.h>
+
+// names are compared in lower case, executable names are case insensitive on Windows
+static void toLower(std::string & name)
+{
+	for(unsigned int i = 0; i < name.size(); i++){
+		if(name[i] >= 'A' && name[i] <= 'Z')
+			name[i] = name[i] - 'A' + 'a';
+	}
+}
+
+ForegroundWatcher::ForegroundWatcher(): _onChange(NULL), _context(NULL)
+{
+#ifdef _WIN32
+	_threadId = 0;
+	_hook = NULL;
+	_readyEvent = NULL;
+#endif
+}
+
+ForegroundWatcher::~ForegroundWatcher()
+{
+	stop();
+}
+
+std::string ForegroundWatcher::getName()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _name;
+}
+
+void ForegroundWatcher::setName(const std::string & name)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(name == _name)
+			return;
+		_name = name;
+	}
+	if(_onChange != NULL)
+		_onChange(_context);
+}
+
+#ifdef _WIN32
+
+ForegroundWatcher * ForegroundWatcher::_instance = NULL;
+
+// executable name of the process owning window, empty if it cannot be queried (e.g. an elevated process)
+static std::string getProcessName(HWND window)
+{
+	DWORD pid = 0;
+	if(window == NULL || GetWindowThreadProcessId(window, &pid) == 0)
+		return "";
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+	if(process == NULL)
+		return "";
+	char path[MAX_PATH];
+	DWORD size = MAX_PATH;
+	BOOL found = QueryFullProcessImageNameA(process, 0, path, &size);
+	CloseHandle(process);
+	if(!found)
+		return "";
+	const char * base = strrchr(path, '\\');
+	std::string name(base != NULL ? base+1 : path);
+	toLower(name);
+	return name;
+}
+
+bool ForegroundWatcher::start(Callback on_change, void * context)
+{
+	_instance = this;
+	setName(getProcessName(GetForegroundWindow()));
+	_onChange = on_change;
+	_context = context;
+	_readyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	_thread = std::thread(&ForegroundWatcher::run, this);
+	WaitForSingleObject(_readyEvent, INFINITE);
+	if(_hook == NULL){
+		fprintf(stderr, "Could not watch the foreground window\n");
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void ForegroundWatcher::stop()
+{
+	if(_thread.joinable()){
+		PostThreadMessage(_threadId, WM_QUIT, 0, 0);
+		_thread.join();
+	}
+	if(_readyEvent != NULL)
+		CloseHandle(_readyEvent);
+	_readyEvent = NULL;
+	_hook = NULL;
+	_instance = NULL;
+}
+
+void CALLBACK ForegroundWatcher::onForeground(HWINEVENTHOOK hook, DWORD event, HWND window, LONG object, LONG child,
+	DWORD thread, DWORD time)
+{
+	if(_instance != NULL && object == OBJID_WINDOW)
+		_instance->setName(getProcessName(window));
+}
+
+void ForegroundWatcher::run()
+{
+	// the thread needs a message queue before the hook is installed and WM_QUIT can be posted to it
+	MSG msg;
+	PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+	_threadId = GetCurrentThreadId();
+	// out of context: the callback runs on this thread while it waits for messages, no dll is loaded into other processes
+	_hook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, NULL, onForeground, 0, 0,
+		WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+	HWINEVENTHOOK hook = _hook;
+	SetEvent(_readyEvent);
+	if(hook == NULL)
+		return;
+	while(GetMessage(&msg, NULL, 0, 0) > 0){
+		DispatchMessage(&msg);
+	}
+	UnhookWinEvent(hook);
+}
+
+#else
+
+bool ForegroundWatcher::start(Callback on_change, void * context)
+{
+	char path[MAX_PATH];
+	getProfileDirectory(path);
+	_path = std::string(path) + PATH_SEPARATOR FOREGROUND_FILE;
+	readFile();
+	_onChange = on_change;
+	_context = context;
+	return _file.start(_path.c_str(), onFileChange, this);
+}
+
+void ForegroundWatcher::stop()
+{
+	_file.stop();
+}
+
+void ForegroundWatcher::onFileChange(void * context)
+{
+	static_cast<ForegroundWatcher*>(context)->readFile();
+}
+
+void ForegroundWatcher::readFile()
+{
+	std::string name;
+	FILE * f = fopen(_path.c_str(), "rb");
+	if(f != NULL){
+		char line[MAX_PATH];
+		if(fgets(line, sizeof(line), f) != NULL)
+			name = line;
+		fclose(f);
+	}
+	size_t end = name.find_last_not_of(" \t\r\n");
+	name.erase(end == std::string::npos ? 0 : end+1);
+	name.erase(0, name.find_first_not_of(" \t"));
+	toLower(name);
+	setName(name);
+}
+
+#endif
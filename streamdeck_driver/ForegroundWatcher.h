@@ -0,0 +1,60 @@
+#ifndef FOREGROUNDWATCHER_H
+#define FOREGROUNDWATCHER_H
+
+#include "Platform.h"
+#include "FileWatcher.h"
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef _WIN32
+#define FOREGROUND_FILE ".streamdeck_foreground"	// executable name of the foreground application (in the user's profile directory)
+#endif
+
+// tracks the executable name (lower case, without directory) of the application in the foreground on a background
+// thread, so nothing has to query the window system when a button is pressed. Backed by SetWinEventHook (Win32) or,
+// as there is no common way to get the focused application on Linux, by the first line of FOREGROUND_FILE, which
+// scripts (or tests) write whenever the focus changes
+class ForegroundWatcher{
+public:
+	// called on the watcher thread after the foreground application changed
+	typedef void (*Callback)(void * context);
+
+	ForegroundWatcher();
+	~ForegroundWatcher();
+
+	// start watching, return false if the foreground changes cannot be watched
+	bool start(Callback on_change, void * context);
+
+	// stop watching and wait for the thread
+	void stop();
+
+	// executable name of the application in the foreground, empty if unknown or not started
+	std::string getName();
+
+private:
+	// store name, call the callback if it differs from the previous one
+	void setName(const std::string & name);
+
+	std::string _name;
+	std::mutex _mutex; // guards _name
+	Callback _onChange;
+	void * _context;
+#ifdef _WIN32
+	static void CALLBACK onForeground(HWINEVENTHOOK hook, DWORD event, HWND window, LONG object, LONG child,
+		DWORD thread, DWORD time);
+	static ForegroundWatcher * _instance; // target of the hook (one watcher per process)
+	void run();
+	std::thread _thread;
+	DWORD _threadId;
+	HWINEVENTHOOK _hook;
+	HANDLE _readyEvent; // set once the thread installed the hook (or failed to)
+#else
+	static void onFileChange(void * context);
+	void readFile();
+	std::string _path;
+	FileWatcher _file;
+#endif
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "Keys.h"
+
+#define KEY_HASH_SIZE 1024	// slots of the perfect hash (power of two)
+#define KEY_HASH_SEED 8198	// first seed without collisions, increase it until the static_assert below passes when keys are added
+
+// all keys, a name that appears first is used when a key is printed by its code
+static constexpr KeyInfo KEYS[] = {
+	{"a", 'A', 0x1E, 30}, {"b", 'B', 0x30, 48}, {"c", 'C', 0x2E, 46}, {"d", 'D', 0x20, 32}, {"e", 'E', 0x12, 18},
+	{"f", 'F', 0x21, 33}, {"g", 'G', 0x22, 34}, {"h", 'H', 0x23, 35}, {"i", 'I', 0x17, 23}, {"j", 'J', 0x24, 36},
+	{"k", 'K', 0x25, 37}, {"l", 'L', 0x26, 38}, {"m", 'M', 0x32, 50}, {"n", 'N', 0x31, 49}, {"o", 'O', 0x18, 24},
+	{"p", 'P', 0x19, 25}, {"q", 'Q', 0x10, 16}, {"r", 'R', 0x13, 19}, {"s", 'S', 0x1F, 31}, {"t", 'T', 0x14, 20},
+	{"u", 'U', 0x16, 22}, {"v", 'V', 0x2F, 47}, {"w", 'W', 0x11, 17}, {"x", 'X', 0x2D, 45}, {"y", 'Y', 0x15, 21},
+	{"z", 'Z', 0x2C, 44}, {"0", '0', 0x0B, 11}, {"1", '1', 0x02, 2}, {"2", '2', 0x03, 3}, {"3", '3', 0x04, 4},
+	{"4", '4', 0x05, 5}, {"5", '5', 0x06, 6}, {"6", '6', 0x07, 7}, {"7", '7', 0x08, 8}, {"8", '8', 0x09, 9},
+	{"9", '9', 0x0A, 10}, {"F1", 0x70, 0x3B, 59}, {"F2", 0x71, 0x3C, 60}, {"F3", 0x72, 0x3D, 61},
+	{"F4", 0x73, 0x3E, 62}, {"F5", 0x74, 0x3F, 63}, {"F6", 0x75, 0x40, 64}, {"F7", 0x76, 0x41, 65},
+	{"F8", 0x77, 0x42, 66}, {"F9", 0x78, 0x43, 67}, {"F10", 0x79, 0x44, 68}, {"F11", 0x7A, 0x57, 87},
+	{"F12", 0x7B, 0x58, 88}, {"F13", 0x7C, 0x64, 183}, {"F14", 0x7D, 0x65, 184}, {"F15", 0x7E, 0x66, 185},
+	{"F16", 0x7F, 0x67, 186}, {"F17", 0x80, 0x68, 187}, {"F18", 0x81, 0x69, 188}, {"F19", 0x82, 0x6A, 189},
+	{"F20", 0x83, 0x6B, 190}, {"F21", 0x84, 0x6C, 191}, {"F22", 0x85, 0x6D, 192}, {"F23", 0x86, 0x6E, 193},
+	{"F24", 0x87, 0x76, 194}, {"Shift", 0x10, 0x2A, 42}, {"Ctrl", 0x11, 0x1D, 29}, {"Control", 0x11, 0x1D, 29},
+	{"Alt", 0x12, 0x38, 56}, {"Win", 0x5B, 0xE05B, 125}, {"LShift", 0xA0, 0x2A, 42}, {"RShift", 0xA1, 0x36, 54},
+	{"LCtrl", 0xA2, 0x1D, 29}, {"RCtrl", 0xA3, 0xE01D, 97}, {"LAlt", 0xA4, 0x38, 56}, {"RAlt", 0xA5, 0xE038, 100},
+	{"LWin", 0x5B, 0xE05B, 125}, {"RWin", 0x5C, 0xE05C, 126}, {"Menu", 0x5D, 0xE05D, 127},
+	{"Apps", 0x5D, 0xE05D, 127}, {"Enter", 0x0D, 0x1C, 28}, {"Return", 0x0D, 0x1C, 28}, {"Esc", 0x1B, 0x01, 1},
+	{"Escape", 0x1B, 0x01, 1}, {"Backspace", 0x08, 0x0E, 14}, {"Tab", 0x09, 0x0F, 15}, {"Space", 0x20, 0x39, 57},
+	{"CapsLock", 0x14, 0x3A, 58}, {"Insert", 0x2D, 0xE052, 110}, {"Ins", 0x2D, 0xE052, 110},
+	{"Delete", 0x2E, 0xE053, 111}, {"Del", 0x2E, 0xE053, 111}, {"Home", 0x24, 0xE047, 102},
+	{"End", 0x23, 0xE04F, 107}, {"PageUp", 0x21, 0xE049, 104}, {"PgUp", 0x21, 0xE049, 104},
+	{"PageDown", 0x22, 0xE051, 109}, {"PgDn", 0x22, 0xE051, 109}, {"Left", 0x25, 0xE04B, 105},
+	{"Up", 0x26, 0xE048, 103}, {"Right", 0x27, 0xE04D, 106}, {"Down", 0x28, 0xE050, 108},
+	{"PrintScreen", 0x2C, 0xE037, 99}, {"PrtSc", 0x2C, 0xE037, 99}, {"ScrollLock", 0x91, 0x46, 70},
+	{"Pause", 0x13, 0x45, 119}, {"NumLock", 0x90, 0xE045, 69}, {"Minus", 0xBD, 0x0C, 12},
+	{"Equal", 0xBB, 0x0D, 13}, {"LeftBracket", 0xDB, 0x1A, 26}, {"RightBracket", 0xDD, 0x1B, 27},
+	{"Backslash", 0xDC, 0x2B, 43}, {"Semicolon", 0xBA, 0x27, 39}, {"Apostrophe", 0xDE, 0x28, 40},
+	{"Grave", 0xC0, 0x29, 41}, {"Comma", 0xBC, 0x33, 51}, {"Period", 0xBE, 0x34, 52}, {"Slash", 0xBF, 0x35, 53},
+	{"Num0", 0x60, 0x52, 82}, {"Num1", 0x61, 0x4F, 79}, {"Num2", 0x62, 0x50, 80}, {"Num3", 0x63, 0x51, 81},
+	{"Num4", 0x64, 0x4B, 75}, {"Num5", 0x65, 0x4C, 76}, {"Num6", 0x66, 0x4D, 77}, {"Num7", 0x67, 0x47, 71},
+	{"Num8", 0x68, 0x48, 72}, {"Num9", 0x69, 0x49, 73}, {"NumMultiply", 0x6A, 0x37, 55},
+	{"NumAdd", 0x6B, 0x4E, 78}, {"NumSubtract", 0x6D, 0x4A, 74}, {"NumDecimal", 0x6E, 0x53, 83},
+	{"NumDivide", 0x6F, 0xE035, 98}, {"NumEnter", 0x0D, 0xE01C, 96}, {"MediaPlayPause", 0xB3, 0xE022, 164},
+	{"MediaStop", 0xB2, 0xE024, 166}, {"MediaNext", 0xB0, 0xE019, 163}, {"MediaPrev", 0xB1, 0xE010, 165},
+	{"VolumeMute", 0xAD, 0xE020, 113}, {"VolumeDown", 0xAE, 0xE02E, 114}, {"VolumeUp", 0xAF, 0xE030, 115},
+	{"BrowserBack", 0xA6, 0xE06A, 158}, {"BrowserForward", 0xA7, 0xE069, 159},
+	{"BrowserRefresh", 0xA8, 0xE067, 173}, {"BrowserHome", 0xAC, 0xE032, 172}, {"LaunchMail", 0xB4, 0xE06C, 155},
+	{"LaunchApp1", 0xB6, 0xE06B, 157}, {"LaunchApp2", 0xB7, 0xE021, 140}
+};
+
+#define NUM_KEYS static_cast<int>(sizeof(KEYS)/sizeof(KEYS[0]))
+
+static constexpr char toLower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static constexpr size_t length(const char * s)
+{
+	size_t n = 0;
+	while(s[n] != '\0')
+		n++;
+	return n;
+}
+
+// FNV-1a of the lower case name
+static constexpr unsigned int keyHash(const char * name, size_t n, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ (seed*0x9E3779B9u);
+	for(size_t i = 0; i < n; i++)
+		h = (h ^ static_cast<unsigned char>(toLower(name[i])))*16777619u;
+	return (h ^ (h >> 15)) & (KEY_HASH_SIZE-1);
+}
+
+// every key has a slot of its own
+static constexpr bool isPerfect(unsigned int seed)
+{
+	bool used[KEY_HASH_SIZE] = {};
+	for(int i = 0; i < NUM_KEYS; i++){
+		unsigned int h = keyHash(KEYS[i].name, length(KEYS[i].name), seed);
+		if(used[h])
+			return false;
+		used[h] = true;
+	}
+	return true;
+}
+
+static_assert(NUM_KEYS < 256, "Key index has to fit into the slots");
+static_assert(isPerfect(KEY_HASH_SEED), "Key names collide, change KEY_HASH_SEED");
+
+// index+1 of the key in each slot (0: empty)
+struct KeySlots{
+	unsigned char key[KEY_HASH_SIZE];
+};
+
+static constexpr KeySlots makeSlots()
+{
+	KeySlots s = {};
+	for(int i = 0; i < NUM_KEYS; i++)
+		s.key[keyHash(KEYS[i].name, length(KEYS[i].name), KEY_HASH_SEED)] = static_cast<unsigned char>(i+1);
+	return s;
+}
+
+// index+1 of the first key of each virtual key code and of each scan code (extended codes at 256+code)
+struct KeyCodes{
+	unsigned char byVK[256];
+	unsigned char byScanCode[512];
+};
+
+static constexpr KeyCodes makeCodes()
+{
+	KeyCodes c = {};
+	for(int i = NUM_KEYS-1; i >= 0; i--){
+		c.byVK[KEYS[i].vk & 0xFF] = static_cast<unsigned char>(i+1);
+		c.byScanCode[(KEYS[i].scanCode & 0xFF) + ((KEYS[i].scanCode >> 8) == 0xE0 ? 256 : 0)] = static_cast<unsigned char>(i+1);
+	}
+	return c;
+}
+
+static constexpr KeySlots KEY_SLOTS = makeSlots();
+static constexpr KeyCodes KEY_CODES = makeCodes();
+
+int findKey(const char * name, size_t length)
+{
+	int index = KEY_SLOTS.key[keyHash(name, length, KEY_HASH_SEED)] - 1;
+	if(index < 0)
+		return -1;
+	// the slot may belong to another name
+	const char * key = KEYS[index].name;
+	for(size_t i = 0; i < length; i++){
+		if(key[i] == '\0' || toLower(key[i]) != toLower(name[i]))
+			return -1;
+	}
+	return key[length] == '\0' ? index : -1;
+}
+
+const KeyInfo & getKey(int index)
+{
+	return KEYS[index];
+}
+
+int getNumKeys()
+{
+	return NUM_KEYS;
+}
+
+int findKeyByVK(int vk)
+{
+	return (vk >= 0 && vk < 256) ? KEY_CODES.byVK[vk] - 1 : -1;
+}
+
+int findKeyByScanCode(int scan_code)
+{
+	int slot = (scan_code & 0xFF) + ((scan_code >> 8) == 0xE0 ? 256 : 0);
+	return (scan_code >= 0 && scan_code <= 0xE0FF) ? KEY_CODES.byScanCode[slot] - 1 : -1;
+}
+
+void setKeyInput(INPUT & input, int key, bool scan_code, bool up)
+{
+	const KeyInfo & k = KEYS[key];
+	ZeroMemory(&input, sizeof(input));
+	input.type = INPUT_KEYBOARD;
+	input.ki.wScan = k.scanCode & 0xFF;
+	if(!scan_code)
+		input.ki.wVk = k.vk;
+	else
+		input.ki.dwFlags |= KEYEVENTF_SCANCODE;
+	// tells right ctrl from left ctrl and arrows from the numpad
+	if((k.scanCode >> 8) == 0xE0)
+		input.ki.dwFlags |= KEYEVENTF_EXTENDEDKEY;
+	if(up)
+		input.ki.dwFlags |= KEYEVENTF_KEYUP;
+}
+
+int getKeyCode(const INPUT & input)
+{
+	int index;
+	if(input.ki.dwFlags & KEYEVENTF_UNICODE)
+		return 0;
+	if(input.ki.dwFlags & KEYEVENTF_SCANCODE)
+		index = findKeyByScanCode(input.ki.wScan | ((input.ki.dwFlags & KEYEVENTF_EXTENDEDKEY) ? 0xE000 : 0));
+	else
+		index = findKeyByVK(input.ki.wVk);
+	return index >= 0 ? KEYS[index].keyCode : 0;
+}
@@ -0,0 +1,31 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include "Platform.h"
+#include <stddef.h>
+
+// a key that can be used in the configuration
+struct KeyInfo{
+	const char * name;	// as written in the configuration (matched case insensitive)
+	WORD vk;			// Windows virtual key code
+	WORD scanCode;		// set 1 scan code, 0xE0xx for extended keys
+	WORD keyCode;		// Linux evdev code (linux/input-event-codes.h)
+};
+
+// index of the key called name (length characters, case insensitive), -1 if there is no such key
+int findKey(const char * name, size_t length);
+
+const KeyInfo & getKey(int index);
+int getNumKeys();
+
+// index of the first key with virtual key code vk or with scan code (0xE0xx for extended keys), -1 if there is none
+int findKeyByVK(int vk);
+int findKeyByScanCode(int scan_code);
+
+// set input to pressing (or releasing) key, by scan code (KEYEVENTF_SCANCODE) or by virtual key code
+void setKeyInput(INPUT & input, int key, bool scan_code, bool up);
+
+// evdev code of a keyboard input (by scan code or virtual key code), 0 if it is not in the table or a unicode character
+int getKeyCode(const INPUT & input);
+
+#endif
@@ -0,0 +1,266 @@
+#include "Log.h"
+#include "Clock.h"
+#include "Protocol.h"
+#include <string.h>
+#include <chrono>
+
+AsyncLog LOG;
+
+// name in the log file, console stream and messages allowed per second (0: no limit) of each event type
+static const struct{
+	const char * name;
+	bool error;
+	unsigned int limit;
+} LOG_EVENTS[NUM_LOG_EVENTS] = {
+	{"info", false, 0},
+	{"button", false, 100},
+	{"deck", false, 20},
+	{"input", false, 0},
+	{"stats", false, 0},
+	{"invalid", true, 5},
+	{"error", true, 20},
+	{"output", true, 5},
+	{"config", true, 0},
+};
+
+AsyncLog::AsyncLog(): _tail(0), _head(0), _overflows(0), _file(NULL), _running(false)
+{
+	_slots = new Slot[LOG_RING_SIZE];
+	for(unsigned int i = 0; i < LOG_RING_SIZE; i++){
+		_slots[i].sequence.store(i);
+	}
+	for(int i = 0; i < NUM_LOG_EVENTS; i++){
+		_limits[i].window.store(0);
+		_limits[i].dropped.store(0);
+	}
+}
+
+AsyncLog::~AsyncLog()
+{
+	stop();
+	if(_file != NULL)
+		fclose(_file);
+	delete[] _slots;
+}
+
+bool AsyncLog::openFile(const char * path)
+{
+	_file = fopen(path, "ab");
+	return _file != NULL;
+}
+
+void AsyncLog::start()
+{
+	if(_running.exchange(true))
+		return;
+	_thread = std::thread(&AsyncLog::run, this);
+}
+
+void AsyncLog::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(!_running.exchange(false))
+			return;
+	}
+	_stop.notify_all();
+	_thread.join();
+	std::lock_guard<std::mutex> lock(_mutex);
+	flush();
+}
+
+void AsyncLog::write(int event, int deck, int button, const char * format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	add(event, deck, button, format, args);
+	va_end(args);
+}
+
+void AsyncLog::print(const char * format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	add(LOG_INFO, -1, -1, format, args);
+	va_end(args);
+}
+
+void AsyncLog::error(const char * format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	add(LOG_ERROR, -1, -1, format, args);
+	va_end(args);
+}
+
+bool AsyncLog::allow(int event, ULONGLONG now)
+{
+	unsigned int limit = LOG_EVENTS[event].limit;
+	if(limit == 0)
+		return true;
+	RateLimit & r = _limits[event];
+	ULONGLONG second = (now / MILLIS_TO_MICROS(1000)) & 0xFFFFFFFF;
+	ULONGLONG state = r.window.load(std::memory_order_relaxed);
+	while(true){
+		// a thread that read the clock just before the window moved on counts in the newer window
+		ULONGLONG window = state >> 32;
+		unsigned int count = static_cast<unsigned int>(state);
+		if(second > window){
+			window = second;
+			count = 0;
+		}
+		if(count >= limit){
+			r.dropped.fetch_add(1);
+			return false;
+		}
+		if(r.window.compare_exchange_weak(state, (window << 32) | (count+1), std::memory_order_relaxed))
+			return true;
+	}
+}
+
+void AsyncLog::add(int event, int deck, int button, const char * format, va_list args)
+{
+	ULONGLONG now = getMonotonicMicros();
+	if(!allow(event, now))
+		return;
+	if(!_running.load()){
+		LogRecord record;
+		record.time = now;
+		record.event = event;
+		record.deck = deck;
+		record.button = button;
+		vsnprintf(record.text, sizeof(record.text), format, args);
+		std::lock_guard<std::mutex> lock(_mutex);
+		output(record);
+		writeFile();
+		return;
+	}
+
+	// claim the next free slot (bounded multi-producer queue, each slot's sequence tells whose turn it is)
+	unsigned int position = _tail.load(std::memory_order_relaxed);
+	Slot * slot;
+	while(true){
+		slot = &_slots[position & (LOG_RING_SIZE-1)];
+		int diff = static_cast<int>(slot->sequence.load(std::memory_order_acquire) - position);
+		if(diff == 0){
+			if(_tail.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+				break;
+		}
+		else if(diff < 0){
+			// the record LOG_RING_SIZE positions earlier was not written yet
+			_overflows.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else{
+			position = _tail.load(std::memory_order_relaxed);
+		}
+	}
+	LogRecord & record = slot->record;
+	record.time = now;
+	record.event = event;
+	record.deck = deck;
+	record.button = button;
+	vsnprintf(record.text, sizeof(record.text), format, args);
+	slot->sequence.store(position+1, std::memory_order_release);
+}
+
+void AsyncLog::run()
+{
+	int interval = LOG_FLUSH_INTERVAL;
+	std::unique_lock<std::mutex> lock(_mutex);
+	while(_running.load()){
+		_stop.wait_for(lock, std::chrono::milliseconds(interval));
+		// writers never wake the thread, it polls less often while nothing is logged
+		if(flush())
+			interval = LOG_FLUSH_INTERVAL;
+		else if(interval < LOG_IDLE_INTERVAL)
+			interval = interval*2 < LOG_IDLE_INTERVAL ? interval*2 : LOG_IDLE_INTERVAL;
+	}
+}
+
+bool AsyncLog::flush()
+{
+	bool written = false;
+	while(true){
+		Slot & slot = _slots[_head & (LOG_RING_SIZE-1)];
+		if(slot.sequence.load(std::memory_order_acquire) != _head+1)
+			break;
+		output(slot.record);
+		slot.sequence.store(_head + LOG_RING_SIZE, std::memory_order_release);
+		_head++;
+		written = true;
+	}
+
+	LogRecord report;
+	report.time = getMonotonicMicros();
+	report.event = LOG_ERROR;
+	report.deck = -1;
+	report.button = -1;
+	for(int i = 0; i < NUM_LOG_EVENTS; i++){
+		unsigned int dropped = _limits[i].dropped.exchange(0);
+		if(dropped > 0){
+			snprintf(report.text, sizeof(report.text), "%u %s messages dropped (more than %u per second)",
+				dropped, LOG_EVENTS[i].name, LOG_EVENTS[i].limit);
+			output(report);
+			written = true;
+		}
+	}
+	unsigned int overflows = _overflows.exchange(0);
+	if(overflows > 0){
+		snprintf(report.text, sizeof(report.text), "%u messages dropped (log full)", overflows);
+		output(report);
+		written = true;
+	}
+	if(written){
+		fflush(stdout);
+		writeFile();
+	}
+	return written;
+}
+
+void AsyncLog::output(const LogRecord & record)
+{
+	FILE * stream = LOG_EVENTS[record.event].error ? stderr : stdout;
+	if(record.button > 0 && record.deck >= 0 && record.deck != DEFAULT_DECK_ID)
+		fprintf(stream, "Deck %d: ", record.deck);
+	fputs(record.text, stream);
+	fputc('\n', stream);
+	if(_file == NULL)
+		return;
+
+	char field[64];
+	snprintf(field, sizeof(field), "{\"time_us\": %llu, \"event\": \"%s\"", record.time, LOG_EVENTS[record.event].name);
+	_fileBuffer += field;
+	if(record.deck >= 0){
+		snprintf(field, sizeof(field), ", \"deck\": %d", record.deck);
+		_fileBuffer += field;
+	}
+	if(record.button >= 0){
+		snprintf(field, sizeof(field), ", \"button\": %d", record.button);
+		_fileBuffer += field;
+	}
+	_fileBuffer += ", \"text\": \"";
+	for(const char * c = record.text; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			_fileBuffer += '\\';
+			_fileBuffer += *c;
+		}
+		else if(static_cast<unsigned char>(*c) < 0x20){
+			snprintf(field, sizeof(field), "\\u%.4x", *c);
+			_fileBuffer += field;
+		}
+		else{
+			_fileBuffer += *c;
+		}
+	}
+	_fileBuffer += "\"}\n";
+}
+
+void AsyncLog::writeFile()
+{
+	if(_file == NULL || _fileBuffer.empty())
+		return;
+	fwrite(_fileBuffer.data(), 1, _fileBuffer.size(), _file);
+	fflush(_file);
+	_fileBuffer.clear();
+}
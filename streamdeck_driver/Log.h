@@ -0,0 +1,101 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "Platform.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define LOG_RING_SIZE			1024	// records waiting to be written (power of two), further records are dropped
+#define LOG_TEXT_SIZE			232		// longer messages are truncated
+#define LOG_FLUSH_INTERVAL		10		// (ms) pending records are written this often
+#define LOG_IDLE_INTERVAL		200		// (ms) the interval grows up to this while nothing is logged
+
+// event types, each has its own rate limit (LOG_EVENTS in Log.cpp)
+#define LOG_INFO		0 // anything else
+#define LOG_BUTTON		1 // a button started a sequence or found its group busy
+#define LOG_DECK		2 // a deck was found, connected or lost
+#define LOG_INPUT		3 // inputs printed by the record output
+#define LOG_STATS		4 // latency summary
+#define LOG_INVALID		5 // invalid data from a deck (a stuck or broken button can send lots of it)
+#define LOG_ERROR		6 // other errors
+#define LOG_OUTPUT		7 // inputs could not be sent (fails for every press while e.g. an elevated window has the focus)
+#define LOG_CONFIG		8 // error in the configuration file (not limited, every error of a reload is shown)
+#define NUM_LOG_EVENTS	9
+
+// one message, formatted in place in the ring
+struct LogRecord{
+	ULONGLONG time; // (monotonic micros)
+	int event; // LOG_*
+	int deck; // deck and button the message is about, -1 if none
+	int button;
+	char text[LOG_TEXT_SIZE];
+};
+
+// structured log of the session: messages are formatted by the calling thread into a preallocated lock-free ring
+// (any number of writing threads, no allocation and no system call) and written to the console and an optional
+// JSON-lines file by a background thread. Each event type is rate limited, the number of dropped messages is
+// logged instead. Writes directly while it is not started
+class AsyncLog{
+public:
+	AsyncLog();
+	~AsyncLog();
+
+	// also write every record as one JSON object per line to path (appended), returns false if it cannot be opened
+	bool openFile(const char * path);
+
+	void start();
+
+	// write everything still pending and stop the thread
+	void stop();
+
+	// message of event type about button of deck (-1 if it is about none), printf format without line break.
+	// Messages about a button of a deck other than the default one get a 'Deck N: ' prefix on the console
+	void write(int event, int deck, int button, const char * format, ...);
+
+	// LOG_INFO / LOG_ERROR message
+	void print(const char * format, ...);
+	void error(const char * format, ...);
+
+private:
+	struct Slot{
+		std::atomic<unsigned int> sequence; // position+1 once the record for position is complete
+		LogRecord record;
+	};
+
+	// messages of an event type in the current one second window, window and count change together
+	struct RateLimit{
+		std::atomic<ULONGLONG> window; // second of the window << 32 | messages in it
+		std::atomic<unsigned int> dropped; // since they were last reported
+	};
+
+	void add(int event, int deck, int button, const char * format, va_list args);
+	bool allow(int event, ULONGLONG now);
+	void run();
+	// write the complete records and report dropped ones, returns false if there was nothing to write
+	bool flush();
+	void output(const LogRecord & record);
+	void writeFile();
+
+	Slot * _slots;
+	std::atomic<unsigned int> _tail; // next position to claim
+	unsigned int _head; // next position to write (background thread)
+	std::atomic<unsigned int> _overflows; // records dropped because the ring was full
+	RateLimit _limits[NUM_LOG_EVENTS];
+	FILE * _file;
+	std::string _fileBuffer; // JSON lines of one flush
+
+	std::thread _thread;
+	std::mutex _mutex; // held while writing (writers only take it while the thread is not running)
+	std::condition_variable _stop;
+	std::atomic<bool> _running;
+};
+
+// console output of the session loop, the deck reader and the connector
+extern AsyncLog LOG;
+
+#endif
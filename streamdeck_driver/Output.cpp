@@ -0,0 +1,176 @@
+#include "Output.h"
+#include "Keys.h"
+#include "Log.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#endif
+
+#define RECORD_LINE_INPUTS 16 // inputs per line of the record output (a line fits into one log record)
+
+// prints the inputs instead of injecting them, one line per batch (longer batches are continued on further lines)
+class RecordingBackend : public OutputBackend{
+public:
+	unsigned int send(const INPUT * inputs, unsigned int count){
+		for(unsigned int first = 0; first < count; first += RECORD_LINE_INPUTS){
+			char line[LOG_TEXT_SIZE];
+			int length = snprintf(line, sizeof(line), first == 0 ? "Input:" : "      ");
+			for(unsigned int i = first; i < count && i < first + RECORD_LINE_INPUTS; i++){
+				char edge = (inputs[i].ki.dwFlags & KEYEVENTF_KEYUP) ? '-' : '+';
+				char * end = line + length;
+				size_t left = sizeof(line) - length;
+				if(inputs[i].ki.dwFlags & KEYEVENTF_UNICODE)
+					length += snprintf(end, left, " %cu%.4x", edge, inputs[i].ki.wScan);
+				else if(inputs[i].ki.dwFlags & KEYEVENTF_SCANCODE)
+					length += snprintf(end, left, " %csc0x%s%.2x", edge, (inputs[i].ki.dwFlags & KEYEVENTF_EXTENDEDKEY) ? "e0" : "", inputs[i].ki.wScan);
+				else
+					length += snprintf(end, left, " %c0x%.2x", edge, inputs[i].ki.wVk);
+			}
+			LOG.write(LOG_INPUT, -1, -1, "%s", line);
+		}
+		return count;
+	}
+};
+
+// drops the inputs, used to measure the driver itself
+class NullBackend : public OutputBackend{
+public:
+	unsigned int send(const INPUT *, unsigned int count){
+		return count;
+	}
+};
+
+#ifdef _WIN32
+
+class SendInputBackend : public OutputBackend{
+public:
+	unsigned int send(const INPUT * inputs, unsigned int count){
+		return SendInput(count, const_cast<INPUT*>(inputs), sizeof(INPUT));
+	}
+};
+
+#else
+
+// virtual keyboard, needs write access to /dev/uinput (unicode characters of typed text are dropped, it only has keys)
+class UinputBackend : public OutputBackend{
+public:
+	UinputBackend(): _fd(-1){}
+
+	~UinputBackend(){
+		if(_fd >= 0){
+			ioctl(_fd, UI_DEV_DESTROY);
+			close(_fd);
+		}
+	}
+
+	bool open(){
+		_fd = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+		if(_fd < 0){
+			fprintf(stderr, "Could not open /dev/uinput: %s\n", strerror(errno));
+			return false;
+		}
+		ioctl(_fd, UI_SET_EVBIT, EV_KEY);
+		ioctl(_fd, UI_SET_EVBIT, EV_SYN);
+		for(int i = 0; i < getNumKeys(); i++){
+			ioctl(_fd, UI_SET_KEYBIT, getKey(i).keyCode);
+		}
+		struct uinput_setup setup;
+		memset(&setup, 0, sizeof(setup));
+		setup.id.bustype = BUS_VIRTUAL;
+		snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "streamdeck_driver");
+		if(ioctl(_fd, UI_DEV_SETUP, &setup) < 0 || ioctl(_fd, UI_DEV_CREATE) < 0){
+			fprintf(stderr, "Could not create uinput device: %s\n", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int send(const INPUT * inputs, unsigned int count){
+		// every key event is followed by a report so transitions are not merged, whole batch in one write
+		_events.resize(count*2);
+		unsigned int n = 0;
+		for(unsigned int i = 0; i < count; i++){
+			int code = getKeyCode(inputs[i]);
+			if(code == 0)
+				continue;
+			event(_events[n++], EV_KEY, code, (inputs[i].ki.dwFlags & KEYEVENTF_KEYUP) ? 0 : 1);
+			event(_events[n++], EV_SYN, SYN_REPORT, 0);
+		}
+		if(n == 0)
+			return count;
+		ssize_t written = write(_fd, &_events[0], n*sizeof(struct input_event));
+		return written == static_cast<ssize_t>(n*sizeof(struct input_event)) ? count : 0;
+	}
+
+private:
+	static void event(struct input_event & e, int type, int code, int value){
+		memset(&e, 0, sizeof(e));
+		e.type = type;
+		e.code = code;
+		e.value = value;
+	}
+
+	int _fd;
+	std::vector<struct input_event> _events;
+};
+
+#endif
+
+OutputBackend * OutputBackend::Create(const char * name)
+{
+	if(name != NULL && !strcmp(name, "record")){
+		return new RecordingBackend();
+	}
+	if(name != NULL && !strcmp(name, "none")){
+		return new NullBackend();
+	}
+#ifdef _WIN32
+	if(name == NULL || !strcmp(name, "sendinput")){
+		return new SendInputBackend();
+	}
+#else
+	if(name == NULL){
+		// keys are printed by default, injecting needs access to /dev/uinput
+		return new RecordingBackend();
+	}
+	if(!strcmp(name, "uinput")){
+		UinputBackend * backend = new UinputBackend();
+		if(backend->open())
+			return backend;
+		delete backend;
+		return NULL;
+	}
+#endif
+	return NULL;
+}
+
+OutputStage::OutputStage(OutputBackend * backend): _backend(backend)
+{
+	_pending.reserve(OUTPUT_BATCH_RESERVE);
+}
+
+OutputStage::~OutputStage()
+{
+	delete _backend;
+}
+
+void OutputStage::add(const INPUT * inputs, unsigned int count)
+{
+	_pending.insert(_pending.end(), inputs, inputs+count);
+}
+
+void OutputStage::flush()
+{
+	if(_pending.empty())
+		return;
+	unsigned int count = static_cast<unsigned int>(_pending.size());
+	unsigned int sent = _backend->send(&_pending[0], count);
+	if(sent != count){
+		LOG.write(LOG_OUTPUT, -1, -1, "Failed to send input: 0x%x", HRESULT_FROM_WIN32(GetLastError()));
+	}
+	_pending.clear();
+}
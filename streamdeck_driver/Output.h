@@ -0,0 +1,40 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "Platform.h"
+#include <vector>
+
+#define OUTPUT_BATCH_RESERVE 256 // inputs the output stage holds before it has to grow
+
+// injects keyboard input, implemented by SendInputBackend (Win32), UinputBackend (Linux), RecordingBackend and NullBackend
+class OutputBackend{
+public:
+	// create backend by name ("sendinput", "uinput", "record" or "none"), NULL selects the platform default,
+	// returns NULL if the name is unknown or the backend could not be set up
+	static OutputBackend * Create(const char * name);
+
+	virtual ~OutputBackend(){}
+
+	// inject inputs in order, returns number of inputs injected
+	virtual unsigned int send(const INPUT * inputs, unsigned int count) = 0;
+};
+
+// collects the inputs of every step that is due in one scheduler tick and injects them with a single
+// call, each step's inputs stay together so simultaneous sequences do not interleave their modifiers
+class OutputStage{
+public:
+	OutputStage(OutputBackend * backend);
+	~OutputStage();
+
+	// queue inputs of a step
+	void add(const INPUT * inputs, unsigned int count);
+
+	// inject everything queued since the last flush
+	void flush();
+
+private:
+	OutputBackend * _backend;
+	std::vector<INPUT> _pending;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "Platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+void getProfileDirectory(char * path)
+{
+	SHGetFolderPathA(NULL, CSIDL_PROFILE, NULL, 0, path);
+}
+
+bool raiseThreadPriority()
+{
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+
+ULONGLONG getFileTime(const char * path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if(!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+		return 0;
+	ULARGE_INTEGER t;
+	t.u.HighPart = attributes.ftLastWriteTime.dwHighDateTime;
+	t.u.LowPart = attributes.ftLastWriteTime.dwLowDateTime;
+	return t.QuadPart;
+}
+
+#else
+
+void getProfileDirectory(char * path)
+{
+	const char * home = getenv("HOME");
+	snprintf(path, MAX_PATH, "%s", home != NULL ? home : ".");
+}
+
+bool raiseThreadPriority()
+{
+	// needs CAP_SYS_NICE or an rtprio limit
+	struct sched_param param;
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+ULONGLONG getFileTime(const char * path)
+{
+	struct stat st;
+	if(stat(path, &st) != 0)
+		return 0;
+	return static_cast<ULONGLONG>(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifdef _WIN32
+#include <windows.h>
+#include <ShlObj.h>
+
+#define PATH_SEPARATOR "\\"
+
+#else
+// minimal subset of the Win32 API used by the driver, so it can be built and tested on Linux
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH_SEPARATOR "/"
+#define MAX_PATH 260
+
+typedef unsigned long long ULONGLONG;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef unsigned int UINT;
+
+#define INPUT_KEYBOARD			1
+#define KEYEVENTF_EXTENDEDKEY	0x0001
+#define KEYEVENTF_KEYUP			0x0002
+#define KEYEVENTF_UNICODE		0x0004
+#define KEYEVENTF_SCANCODE		0x0008
+
+#define VK_TAB		0x09
+#define VK_RETURN	0x0D
+#define VK_SHIFT	0x10
+#define VK_CONTROL	0x11
+#define VK_MENU		0x12
+#define VK_LWIN		0x5B
+
+typedef struct {
+	WORD wVk;
+	WORD wScan;
+	DWORD dwFlags;
+	DWORD time;
+	uintptr_t dwExtraInfo;
+} KEYBDINPUT;
+
+typedef struct {
+	DWORD type;
+	KEYBDINPUT ki;
+} INPUT;
+
+#define ZeroMemory(p, n)		memset((p), 0, (n))
+#define GetLastError()			(errno)
+#define HRESULT_FROM_WIN32(e)	(e)
+
+inline void Sleep(DWORD ms){ usleep(ms*1000); }
+
+#endif
+
+// write home directory of the current user (without trailing separator) to path (MAX_PATH)
+void getProfileDirectory(char * path);
+
+// run the calling thread at the highest priority the process may use (time critical on Win32, SCHED_FIFO on Linux),
+// returns false if the priority could not be raised
+bool raiseThreadPriority();
+
+// last modification time of a file (in platform specific units, only for comparison), 0 if it does not exist
+ULONGLONG getFileTime(const char * path);
+
+#endif
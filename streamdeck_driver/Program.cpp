@@ -0,0 +1,405 @@
+#include "Program.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define PROGRAM_IMAGE_ALIGNMENT 16 // options and block start at multiples of this (INPUT alignment)
+
+// fixed size header of a program image, followed by the options and the block
+struct ProgramImageHeader{
+	char magic[4];
+	unsigned int version;
+	unsigned int inputSize; // sizeof(INPUT), differs between 32 and 64 bit builds
+	unsigned int numInputs;
+	unsigned int numSteps;
+	unsigned int numButtons;
+	unsigned int numGroups;
+	unsigned int numDecks;
+	unsigned int numProfiles;
+	unsigned int optionsSize;
+	unsigned int checksum; // crc32 of everything after the header
+	unsigned int reserved[5];
+};
+
+static size_t align(size_t size)
+{
+	return (size + PROGRAM_IMAGE_ALIGNMENT-1) & ~static_cast<size_t>(PROGRAM_IMAGE_ALIGNMENT-1);
+}
+
+static unsigned int crc32(unsigned int crc, const char * data, size_t length)
+{
+	static unsigned int table[256] = {0};
+	if(table[1] == 0){
+		for(unsigned int i = 0; i < 256; i++){
+			unsigned int c = i;
+			for(int bit = 0; bit < 8; bit++){
+				c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : (c >> 1);
+			}
+			table[i] = c;
+		}
+	}
+	crc = ~crc;
+	for(size_t i = 0; i < length; i++){
+		crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static size_t blockSize(unsigned int num_inputs, unsigned int num_steps, unsigned int num_buttons, unsigned int num_decks,
+	unsigned int num_profiles)
+{
+	return num_inputs*sizeof(INPUT) + num_steps*sizeof(ProgramStep) + num_buttons*sizeof(ProgramButton) +
+		num_decks*sizeof(ProgramDeck) + num_profiles*sizeof(ProgramProfile);
+}
+
+Program::Program():
+	_data(NULL), _view(NULL), _viewSize(0), _size(0), _inputs(NULL), _steps(NULL), _buttons(NULL), _decks(NULL), _profiles(NULL),
+	_base(this), _numInputs(0), _numSteps(0), _numButtons(0), _numGroups(0), _numDecks(0), _numAllDecks(0), _numProfiles(0)
+{
+}
+
+Program::~Program()
+{
+	for(unsigned int i = 1; i < _profilePrograms.size(); i++){
+		delete _profilePrograms[i];
+	}
+	free(_data);
+	if(_view != NULL){
+#ifdef _WIN32
+		UnmapViewOfFile(_view);
+#else
+		munmap(_view, _viewSize);
+#endif
+	}
+}
+
+void Program::setBlock(const char * data, unsigned int num_inputs, unsigned int num_steps, int num_buttons, int num_decks, int num_profiles)
+{
+	// INPUT has the strictest alignment, so it goes first
+	_inputs = reinterpret_cast<const INPUT*>(data);
+	_steps = reinterpret_cast<const ProgramStep*>(data + num_inputs*sizeof(INPUT));
+	_buttons = reinterpret_cast<const ProgramButton*>(data + num_inputs*sizeof(INPUT) + num_steps*sizeof(ProgramStep));
+	_decks = reinterpret_cast<const ProgramDeck*>(_buttons + num_buttons);
+	_profiles = reinterpret_cast<const ProgramProfile*>(_decks + num_decks);
+	_numInputs = num_inputs;
+	_numSteps = num_steps;
+	_numButtons = num_buttons;
+	_numDecks = num_decks;
+	_numAllDecks = num_decks;
+	_numProfiles = num_profiles;
+}
+
+void Program::setupProfiles()
+{
+	_profilePrograms.assign(1, this);
+	for(int i = 1; i < _numProfiles; i++){
+		// shares everything but the decks
+		Program * p = new Program();
+		p->_inputs = _inputs;
+		p->_steps = _steps;
+		p->_buttons = _buttons;
+		p->_decks = _decks + _profiles[i].firstDeck;
+		p->_profiles = _profiles;
+		p->_base = this;
+		p->_numInputs = _numInputs;
+		p->_numSteps = _numSteps;
+		p->_numButtons = _numButtons;
+		p->_numGroups = _numGroups;
+		p->_numDecks = _profiles[i].numDecks;
+		p->_numAllDecks = _numAllDecks;
+		p->_numProfiles = _numProfiles;
+		_profilePrograms.push_back(p);
+	}
+	_decks += _profiles[0].firstDeck;
+	_numDecks = _profiles[0].numDecks;
+}
+
+int Program::findProfile(const char * name) const
+{
+	for(int i = 1; i < _numProfiles; i++){
+		if(strcmp(_profiles[i].name, name) == 0)
+			return i;
+	}
+	return 0;
+}
+
+Program * Program::MapImage(const char * path, void * options, unsigned int options_size)
+{
+	void * view = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER file_size;
+	if(GetFileSizeEx(file, &file_size) && file_size.QuadPart >= static_cast<LONGLONG>(sizeof(ProgramImageHeader))){
+		HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping != NULL){
+			// the view keeps the mapping alive
+			view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = static_cast<size_t>(file_size.QuadPart);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return NULL;
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(ProgramImageHeader))){
+		view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(view == MAP_FAILED)
+			view = NULL;
+		size = st.st_size;
+	}
+	close(fd);
+#endif
+	if(view == NULL)
+		return NULL;
+
+	Program * p = new Program();
+	p->_view = view;
+	p->_viewSize = size;
+
+	const char * image = static_cast<const char*>(view);
+	const ProgramImageHeader * header = reinterpret_cast<const ProgramImageHeader*>(image);
+	if(memcmp(header->magic, PROGRAM_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != PROGRAM_IMAGE_VERSION ||
+		header->inputSize != sizeof(INPUT) ||
+		header->optionsSize != options_size){
+		delete p;
+		return NULL;
+	}
+	size_t block_offset = sizeof(ProgramImageHeader) + align(options_size);
+	size_t block_size = blockSize(header->numInputs, header->numSteps, header->numButtons, header->numDecks, header->numProfiles);
+	if(size != block_offset + block_size ||
+		crc32(0, image + sizeof(ProgramImageHeader), size - sizeof(ProgramImageHeader)) != header->checksum){
+		delete p;
+		return NULL;
+	}
+
+	p->setBlock(image + block_offset, header->numInputs, header->numSteps, header->numButtons, header->numDecks, header->numProfiles);
+	p->_size = block_size;
+	p->_numGroups = header->numGroups;
+	// steps and inputs are used without bounds checks later on
+	for(int i = 0; i < p->_numButtons; i++){
+		const ProgramButton & b = p->_buttons[i];
+		bool valid = b.groupIndex >= 0 && b.groupIndex < p->_numGroups && b.groupPolicy >= 0 && b.groupPolicy < NUM_GROUP_POLICIES &&
+			b.queueDepth >= 0 && b.queueDepth <= GROUP_QUEUE_MAX;
+		for(int t = 0; t < NUM_TRIGGERS && valid; t++){
+			const ProgramSequence & sequence = b.sequences[t];
+			valid = sequence.firstStep <= p->_numSteps && sequence.numSteps <= p->_numSteps - sequence.firstStep;
+		}
+		if(!valid){
+			delete p;
+			return NULL;
+		}
+	}
+	for(int i = 0; i < p->_numAllDecks; i++){
+		const ProgramDeck & d = p->_decks[i];
+		if(d.firstButton < 0 || d.numButtons < 0 || d.numButtons > p->_numButtons - d.firstButton){
+			delete p;
+			return NULL;
+		}
+	}
+	for(int i = 0; i < p->_numProfiles; i++){
+		const ProgramProfile & profile = p->_profiles[i];
+		if(profile.firstDeck < 0 || profile.numDecks < 0 || profile.numDecks > p->_numAllDecks - profile.firstDeck ||
+			memchr(profile.name, '\0', sizeof(profile.name)) == NULL){
+			delete p;
+			return NULL;
+		}
+	}
+	if(p->_numProfiles < 1){
+		delete p;
+		return NULL;
+	}
+	p->setupProfiles();
+	for(unsigned int i = 0; i < p->_numSteps; i++){
+		if(p->_steps[i].offset > p->_numInputs || p->_steps[i].count > p->_numInputs - p->_steps[i].offset){
+			delete p;
+			return NULL;
+		}
+	}
+	memcpy(options, image + sizeof(ProgramImageHeader), options_size);
+	return p;
+}
+
+bool Program::saveImage(const char * path, const void * options, unsigned int options_size) const
+{
+	ProgramImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROGRAM_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = PROGRAM_IMAGE_VERSION;
+	header.inputSize = sizeof(INPUT);
+	header.numInputs = _numInputs;
+	header.numSteps = _numSteps;
+	header.numButtons = _numButtons;
+	header.numGroups = _numGroups;
+	header.numDecks = _numAllDecks;
+	header.numProfiles = _numProfiles;
+	header.optionsSize = options_size;
+
+	std::string body(align(options_size), '\0');
+	memcpy(&body[0], options, options_size);
+	body.append(reinterpret_cast<const char*>(_inputs), _size);
+	header.checksum = crc32(0, body.data(), body.size());
+
+	// written next to the final file and renamed, so a crash never leaves a half written image behind
+	std::string temp_path = std::string(path) + ".tmp";
+	FILE * f = fopen(temp_path.c_str(), "wb");
+	if(!f)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(body.data(), 1, body.size(), f) == body.size();
+	ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+	ok = ok && MoveFileExA(temp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && rename(temp_path.c_str(), path) == 0;
+#endif
+	if(!ok)
+		remove(temp_path.c_str());
+	return ok;
+}
+
+void ProgramBuilder::addProfile(const char * name)
+{
+	ProgramProfile p;
+	memset(&p, 0, sizeof(p));
+	strncpy(p.name, name, sizeof(p.name)-1);
+	p.firstDeck = static_cast<int>(_decks.size());
+	p.numDecks = 0;
+	_profiles.push_back(p);
+}
+
+void ProgramBuilder::addDeck(int id)
+{
+	if(!_profiles.empty())
+		_profiles.back().numDecks++;
+	ProgramDeck d;
+	d.id = id;
+	d.firstButton = static_cast<int>(_buttons.size());
+	d.numButtons = 0;
+	_decks.push_back(d);
+}
+
+void ProgramBuilder::addButton(int id, int group)
+{
+	if(_decks.empty() || (!_profiles.empty() && _profiles.back().numDecks == 0))
+		addDeck(DEFAULT_DECK_ID);
+	_decks.back().numButtons++;
+
+	ProgramButton b;
+	b.deck = _decks.back().id;
+	b.id = id;
+	b.group = group;
+	b.groupIndex = 0;
+	b.groupPolicy = GROUP_POLICY_DROP;
+	b.queueDepth = 0;
+	for(int t = 0; t < NUM_TRIGGERS; t++){
+		b.sequences[t].firstStep = static_cast<unsigned int>(_steps.size());
+		b.sequences[t].numSteps = 0;
+	}
+	b.longTime = 0;
+	b.repeatInterval = 0;
+	_buttons.push_back(b);
+	_trigger = TRIGGER_PRESS;
+}
+
+void ProgramBuilder::addSequence(int trigger)
+{
+	_trigger = trigger;
+	_buttons.back().sequences[trigger].firstStep = static_cast<unsigned int>(_steps.size());
+	_buttons.back().sequences[trigger].numSteps = 0;
+}
+
+void ProgramBuilder::setHold(int long_time, int repeat_interval)
+{
+	_buttons.back().longTime = long_time;
+	_buttons.back().repeatInterval = repeat_interval;
+}
+
+void ProgramBuilder::addStep(const INPUT * inputs, unsigned int count, int delay)
+{
+	ProgramStep s;
+	s.offset = static_cast<unsigned int>(_inputs.size());
+	s.count = count;
+	s.delay = delay;
+	_inputs.insert(_inputs.end(), inputs, inputs+count);
+	_steps.push_back(s);
+	_buttons.back().sequences[_trigger].numSteps++;
+}
+
+void ProgramBuilder::setGroupPolicy(int deck, int group, int policy, int queue_depth)
+{
+	_policies[std::make_pair(deck, group)] = std::make_pair(policy, policy == GROUP_POLICY_QUEUE ? queue_depth : 0);
+}
+
+Program * ProgramBuilder::compile()
+{
+	// groups of different decks never block each other
+	std::map<std::pair<int, int>, int> groups;
+	for(unsigned int i = 0; i < _buttons.size(); i++){
+		std::pair<int, int> key(_buttons[i].deck, _buttons[i].group);
+		std::map<std::pair<int, int>, int>::iterator it = groups.find(key);
+		if(it == groups.end()){
+			int index = static_cast<int>(groups.size());
+			it = groups.insert(std::make_pair(key, index)).first;
+		}
+		_buttons[i].groupIndex = it->second;
+		std::map<std::pair<int, int>, std::pair<int, int> >::iterator policy = _policies.find(key);
+		if(policy != _policies.end()){
+			_buttons[i].groupPolicy = policy->second.first;
+			_buttons[i].queueDepth = policy->second.second;
+		}
+	}
+
+	size_t inputs_size = _inputs.size()*sizeof(INPUT);
+	size_t steps_size = _steps.size()*sizeof(ProgramStep);
+	size_t buttons_size = _buttons.size()*sizeof(ProgramButton);
+	size_t decks_size = _decks.size()*sizeof(ProgramDeck);
+	if(_profiles.empty()){
+		// everything is the default mapping
+		addProfile("");
+		_profiles.back().firstDeck = 0;
+		_profiles.back().numDecks = static_cast<int>(_decks.size());
+	}
+	size_t profiles_size = _profiles.size()*sizeof(ProgramProfile);
+
+	Program * p = new Program();
+	p->_size = inputs_size + steps_size + buttons_size + decks_size + profiles_size;
+	p->_data = static_cast<char*>(malloc(p->_size > 0 ? p->_size : 1));
+	if(inputs_size > 0)
+		memcpy(p->_data, &_inputs[0], inputs_size);
+	if(steps_size > 0)
+		memcpy(p->_data + inputs_size, &_steps[0], steps_size);
+	if(buttons_size > 0)
+		memcpy(p->_data + inputs_size + steps_size, &_buttons[0], buttons_size);
+	if(decks_size > 0)
+		memcpy(p->_data + inputs_size + steps_size + buttons_size, &_decks[0], decks_size);
+	memcpy(p->_data + inputs_size + steps_size + buttons_size + decks_size, &_profiles[0], profiles_size);
+	p->setBlock(p->_data, static_cast<unsigned int>(_inputs.size()), static_cast<unsigned int>(_steps.size()),
+		static_cast<int>(_buttons.size()), static_cast<int>(_decks.size()), static_cast<int>(_profiles.size()));
+	p->_numGroups = static_cast<int>(groups.size());
+	p->setupProfiles();
+	return p;
+}
+
+void ProgramBuilder::clear()
+{
+	_inputs.clear();
+	_steps.clear();
+	_buttons.clear();
+	_decks.clear();
+	_profiles.clear();
+	_policies.clear();
+}
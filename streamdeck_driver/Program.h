@@ -0,0 +1,194 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "Platform.h"
+#include <stddef.h>
+#include "Protocol.h"
+#include <map>
+#include <vector>
+
+#define PROGRAM_IMAGE_MAGIC "SDPI"
+#define PROGRAM_IMAGE_VERSION 5 // increase whenever the layout of ProgramStep/ProgramButton/ProgramProfile changes
+
+// one step of a button's sequence: count inputs (starting at offset in the input arena) sent together,
+// delay milliseconds after the previous step
+struct ProgramStep{
+	unsigned int offset;
+	unsigned int count; // 0 for a step that only waits
+	int delay;
+};
+
+// what starts a sequence of a button
+#define TRIGGER_PRESS	0 // button pressed (released before longTime if the button has a long press sequence)
+#define TRIGGER_RELEASE	1 // button released
+#define TRIGGER_LONG	2 // button held for longTime
+#define NUM_TRIGGERS	3
+
+// what a press does while its group is busy
+#define GROUP_POLICY_DROP		0 // ignored (default)
+#define GROUP_POLICY_QUEUE		1 // started once the group is free, up to queueDepth presses wait
+#define GROUP_POLICY_PREEMPT	2 // the running sequence is cancelled and the pressed one starts
+#define GROUP_POLICY_TOGGLE		3 // pressing the running button again cancels its sequence, other presses are ignored
+#define NUM_GROUP_POLICIES		4
+#define GROUP_QUEUE_MAX			16 // largest queueDepth
+
+struct ProgramSequence{
+	unsigned int firstStep; // index of the sequence's first step
+	unsigned int numSteps;
+};
+
+struct ProgramButton{
+	int deck; // id of the deck the button belongs to
+	int id;
+	int group;
+	int groupIndex; // dense index of (deck, group) (0..getNumGroups()-1)
+	int groupPolicy; // GROUP_POLICY_*, the same for all buttons of the group
+	int queueDepth; // presses waiting at most (GROUP_POLICY_QUEUE)
+	ProgramSequence sequences[NUM_TRIGGERS]; // by trigger, numSteps is 0 if there is none
+	int longTime; // (ms) hold time for TRIGGER_LONG, 0 if the button has no long press sequence
+	int repeatInterval; // (ms) TRIGGER_PRESS sequence is repeated this often while held, 0 for no repeat
+};
+
+// buttons of one deck, button id X is stored at index firstButton+X-1
+struct ProgramDeck{
+	int id;
+	int firstButton;
+	int numButtons;
+};
+
+#define PROFILE_NAME_SIZE 64 // longest executable name of an application profile (including the terminating 0)
+
+// decks of one application profile, profile 0 is the default mapping (name "")
+struct ProgramProfile{
+	char name[PROFILE_NAME_SIZE]; // executable name of the application in lower case
+	int firstDeck;
+	int numDecks;
+};
+
+// immutable compiled configuration, all prebuilt INPUT records, steps and buttons live in one block:
+// running a sequence reads it linearly and dropping the program frees a single buffer.
+// The block can be stored as binary image and mapped back without parsing the configuration again
+class Program{
+public:
+	~Program();
+
+	// map image written by saveImage(), options_size bytes stored with it are copied to options,
+	// returns NULL if the file is missing, damaged or from another version (or build with a different INPUT layout)
+	static Program * MapImage(const char * path, void * options, unsigned int options_size);
+
+	// write versioned and checksummed image together with an options block, the file is replaced atomically
+	bool saveImage(const char * path, const void * options, unsigned int options_size) const;
+
+	int getNumButtons() const {return _numButtons;}
+	int getNumGroups() const {return _numGroups;}
+	int getNumDecks() const {return _numDecks;}
+
+	// button by index (in the order the buttons were added)
+	const ProgramButton & getButton(int index) const {return _buttons[index];}
+
+	const ProgramDeck & getDeck(int index) const {return _decks[index];}
+
+	// application profiles, each one is a program of its own (sharing this block) whose decks hold the complete mapping
+	// while the application is in the foreground. The program returned by compile() or MapImage() is profile 0
+	int getNumProfiles() const {return _numProfiles;}
+	const char * getProfileName(int index) const {return _profiles[index].name;}
+	const Program * getProfile(int index) const {return _base->_profilePrograms[index];}
+
+	// index of the profile of the application with executable name (lower case), 0 if it has none
+	int findProfile(const char * name) const;
+
+	// program that owns the block (profile 0)
+	const Program * getBase() const {return _base;}
+
+	// index of button id of deck, -1 if it is not mapped
+	int findButton(int deck, int id) const{
+		for(int i = 0; i < _numDecks; i++){
+			if(_decks[i].id == deck)
+				return (id >= 1 && id <= _decks[i].numButtons) ? _decks[i].firstButton + id-1 : -1;
+		}
+		return -1;
+	}
+
+	const ProgramStep & getStep(unsigned int index) const {return _steps[index];}
+
+	// inputs of step
+	const INPUT * getInputs(const ProgramStep & step) const {return _inputs + step.offset;}
+
+	// size of the block in bytes
+	size_t getSize() const {return _size;}
+
+private:
+	friend class ProgramBuilder;
+	Program();
+
+	void setBlock(const char * data, unsigned int num_inputs, unsigned int num_steps, int num_buttons, int num_decks, int num_profiles);
+
+	// create the programs of the profiles, this one becomes profile 0
+	void setupProfiles();
+
+	char * _data; // inputs | steps | buttons | decks | profiles (malloc'ed), NULL if mapped
+	void * _view; // mapped image
+	size_t _viewSize;
+	size_t _size;
+	const INPUT * _inputs;
+	const ProgramStep * _steps;
+	const ProgramButton * _buttons;
+	const ProgramDeck * _decks; // of this profile
+	const ProgramProfile * _profiles;
+	const Program * _base;
+	std::vector<Program*> _profilePrograms; // by profile index (base only)
+	unsigned int _numInputs;
+	unsigned int _numSteps;
+	int _numButtons;
+	int _numGroups;
+	int _numDecks;
+	int _numAllDecks; // of all profiles
+	int _numProfiles;
+};
+
+// collects buttons and steps while the configuration is parsed
+class ProgramBuilder{
+public:
+	ProgramBuilder(): _trigger(TRIGGER_PRESS){}
+
+	// start the next application profile (executable name, at most PROFILE_NAME_SIZE-1 characters), following decks
+	// belong to it. The first profile is the default one, without any profile all decks are in the default profile
+	void addProfile(const char * name);
+
+	// start the next deck, following buttons belong to it (deck DEFAULT_DECK_ID if no deck was added)
+	void addDeck(int id);
+
+	// start the next button of the last deck added, ids have to be added in order starting at 1,
+	// following steps belong to its TRIGGER_PRESS sequence
+	void addButton(int id, int group);
+
+	// following steps belong to the sequence of trigger of the last button added (each trigger at most once)
+	void addSequence(int trigger);
+
+	// long press time and repeat interval (ms) of the last button added
+	void setHold(int long_time, int repeat_interval);
+
+	// append a step to the current sequence of the last button added
+	void addStep(const INPUT * inputs, unsigned int count, int delay);
+
+	// policy (GROUP_POLICY_*) of group of deck, queue_depth for GROUP_POLICY_QUEUE (1..GROUP_QUEUE_MAX),
+	// groups without one drop presses while they are busy
+	void setGroupPolicy(int deck, int group, int policy, int queue_depth);
+
+	// copy everything into one block, groups are numbered in order of appearance (separately for each deck)
+	// (caller owns the program, the builder can be reused after clear())
+	Program * compile();
+
+	void clear();
+
+private:
+	std::vector<INPUT> _inputs;
+	std::vector<ProgramStep> _steps;
+	std::vector<ProgramButton> _buttons;
+	std::vector<ProgramDeck> _decks;
+	std::vector<ProgramProfile> _profiles;
+	std::map<std::pair<int, int>, std::pair<int, int> > _policies; // (policy, queue depth) by (deck, group)
+	int _trigger; // sequence steps are added to
+};
+
+#endif
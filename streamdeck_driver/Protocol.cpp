@@ -0,0 +1,68 @@
+#include "Protocol.h"
+#include <string.h>
+
+unsigned char crc8(const unsigned char * data, int length)
+{
+	unsigned char crc = 0;
+	for(int i = 0; i < length; i++){
+		crc ^= data[i];
+		for(int bit = 0; bit < 8; bit++){
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+int encodeFrame(unsigned char * out, unsigned char seq, unsigned char type, const unsigned char * payload, int length)
+{
+	out[0] = FRAME_SOF;
+	out[1] = static_cast<unsigned char>(length);
+	out[2] = seq;
+	out[3] = type;
+	memcpy(out+FRAME_HEADER_SIZE, payload, length);
+	out[FRAME_HEADER_SIZE+length] = crc8(out+1, FRAME_HEADER_SIZE-1+length);
+	return FRAME_HEADER_SIZE+length+1;
+}
+
+void FrameDecoder::error()
+{
+	_errors++;
+	_consecutiveErrors++;
+	_pos = 0;
+}
+
+bool FrameDecoder::feed(unsigned char c, Frame & frame)
+{
+	if(_pos == 0){
+		if(c != FRAME_SOF){
+			error();
+			return false;
+		}
+	}
+	else if(_pos == 1 && c > FRAME_MAX_PAYLOAD){
+		error();
+		// this byte might be the start of the next frame
+		if(c == FRAME_SOF){
+			_buffer[_pos++] = c;
+		}
+		return false;
+	}
+	_buffer[_pos++] = c;
+
+	if(_pos < FRAME_HEADER_SIZE+1 || _pos < FRAME_HEADER_SIZE+_buffer[1]+1){
+		return false;
+	}
+
+	int length = _buffer[1];
+	_pos = 0;
+	if(crc8(_buffer+1, FRAME_HEADER_SIZE-1+length) != _buffer[FRAME_HEADER_SIZE+length]){
+		error();
+		return false;
+	}
+	frame.length = static_cast<unsigned char>(length);
+	frame.seq = _buffer[2];
+	frame.type = _buffer[3];
+	memcpy(frame.payload, _buffer+FRAME_HEADER_SIZE, length);
+	_consecutiveErrors = 0;
+	return true;
+}
@@ -0,0 +1,117 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// constants of the serial protocol, need to match arduino/streamdeck_sketch
+
+#define MAGIC_WORDS	"ccstreamdeck"	// magic words need to be received by arduino so we know that this is indeed the stream deck we are talking to
+#define DEVICE_NUM_BUTTONS 16		// number of buttons of decks that do not report it (v1)
+#define MAX_DEVICE_BUTTONS 255		// button ids are sent as one byte
+#define DEFAULT_DECK_ID 0			// id of decks that do not report one (v1 and early v2 firmware)
+#define MAX_DECK_ID 255				// deck ids are sent as one byte
+#define CONNECTION_LOST_TIMEOUT 500	// (ms) arduino drops the connection if nothing was received from the host for this long
+#define HANDSHAKE_INTERVAL 1000		// (ms) arduino repeats the magic words this often until they are sent back
+
+// protocol versions, v1: raw bytes (button id / active state), v2: framed, negotiated after the handshake
+#define PROTOCOL_V1 1
+#define PROTOCOL_V2 2
+
+#define BAUD_RATE_V1 9600		// handshake and v1 always run at this rate
+#define BAUD_RATE_V2 115200		// switched to after the deck acknowledged v2
+#define BAUD_CODE_115200 1		// baud rate requested in HELLO
+
+#define NEGOTIATION_TIMEOUT 200	// (ms) old firmware does not answer HELLO, fall back to v1 after this
+#define RESEND_TIMEOUT 30		// (ms) deck resends button/event frames not acknowledged by a STATE frame after this
+#define RESEND_QUEUE_SIZE 8		// number of unacknowledged button/event frames kept by the deck
+
+// v2 frame: SOF | length | sequence | type | payload (length bytes) | crc8 (length..payload)
+#define FRAME_SOF			0xA5
+#define FRAME_HEADER_SIZE	4
+#define FRAME_MAX_PAYLOAD	16
+#define FRAME_MAX_SIZE		(FRAME_HEADER_SIZE+FRAME_MAX_PAYLOAD+1)
+
+// frame types
+#define FRAME_HELLO		0x01 // host -> deck: version, baud code
+#define FRAME_HELLO_ACK	0x02 // deck -> host: version, number of buttons, deck id (optional), features (optional)
+#define FRAME_BUTTON	0x03 // deck -> host: button id (press only, firmware without DECK_FEATURE_EVENTS)
+#define FRAME_STATE		0x04 // host -> deck: active, sequence number of last button/event frame received in order
+#define FRAME_EVENT		0x05 // deck -> host: button id, edge, device time (us, 4 bytes little endian)
+#define FRAME_LEDS		0x06 // host -> deck: byte offset, busy bitmap from button offset*8+1 on (bit 0 of the first byte)
+
+#define DECK_FEATURE_EVENTS 0x01 // deck sends FRAME_EVENT for presses and releases instead of FRAME_BUTTON
+#define DECK_FEATURE_LEDS	0x02 // deck shows the busy state of each button, the host sends FRAME_LEDS when it changes
+
+#define LED_BITMAP_SIZE		((MAX_DEVICE_BUTTONS+7)/8)	// bytes of the busy bitmap of all buttons
+#define LED_FRAME_BYTES		(FRAME_MAX_PAYLOAD-1)		// bitmap bytes carried by one FRAME_LEDS
+
+// button edges of FRAME_EVENT
+#define EDGE_PRESS		1
+#define EDGE_RELEASE	2
+#define EVENT_PAYLOAD_SIZE 6
+
+#define FRAME_DECODE_ERROR_LIMIT 16 // host gives up on the link after this many consecutive bad bytes/frames
+
+struct Frame{
+	unsigned char seq;
+	unsigned char type;
+	unsigned char length;
+	unsigned char payload[FRAME_MAX_PAYLOAD];
+};
+
+// crc-8 (polynomial 0x07), same implementation as in the sketch
+unsigned char crc8(const unsigned char * data, int length);
+
+// write frame to out (FRAME_MAX_SIZE bytes), returns number of bytes
+int encodeFrame(unsigned char * out, unsigned char seq, unsigned char type, const unsigned char * payload, int length);
+
+// reassembles frames from a byte stream, resynchronizes on FRAME_SOF after errors
+class FrameDecoder{
+public:
+	FrameDecoder(): _pos(0), _errors(0), _consecutiveErrors(0){}
+
+	// feed next byte, returns true if a valid frame is completed
+	bool feed(unsigned char c, Frame & frame);
+
+	// total number of dropped bytes/frames
+	unsigned long getErrors(){return _errors;}
+
+	// dropped bytes/frames since the last valid frame
+	int getConsecutiveErrors(){return _consecutiveErrors;}
+
+private:
+	void error();
+
+	unsigned char _buffer[FRAME_MAX_SIZE];
+	int _pos;
+	unsigned long _errors;
+	int _consecutiveErrors;
+};
+
+// finds the magic words in a byte stream, the arduino announces itself after a reset
+// or a lost connection so they can show up at any point
+class MagicWordMatcher{
+public:
+	MagicWordMatcher(): _matched(0){}
+
+	// feed next received byte, returns true if it completed the magic words
+	bool feed(char c){
+		if(c == MAGIC_WORDS[_matched]){
+			_matched++;
+		}
+		else{
+			_matched = (c == MAGIC_WORDS[0]) ? 1 : 0;
+		}
+		if(_matched == sizeof(MAGIC_WORDS)-1){
+			_matched = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// some magic words characters have been received
+	bool inProgress(){return _matched > 0;}
+
+private:
+	unsigned int _matched;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "Scheduler.h"
+#include <assert.h>
+
+void Scheduler::start(ScheduledTask * task, ULONGLONG now)
+{
+	cancel(task);
+	int delay = task->begin();
+	if(delay >= 0){
+		push(task, now + MILLIS_TO_MICROS(delay));
+	}
+}
+
+void Scheduler::cancel(ScheduledTask * task)
+{
+	remove(task);
+	task->_generation++;
+	task->_scheduled = false;
+	task->_paused = false;
+}
+
+void Scheduler::pause(ScheduledTask * task, ULONGLONG now)
+{
+	if(!task->_scheduled)
+		return;
+	ULONGLONG deadline = _heap[task->_heapIndex].deadline;
+	task->_remaining = deadline > now ? deadline - now : 0;
+	cancel(task);
+	task->_paused = true;
+}
+
+void Scheduler::resume(ScheduledTask * task, ULONGLONG now)
+{
+	if(!task->_paused)
+		return;
+	task->_paused = false;
+	push(task, now + task->_remaining);
+}
+
+void Scheduler::clear()
+{
+	for(unsigned int i = 0; i < _heap.size(); i++){
+		ScheduledTask * task = _heap[i].task;
+		task->_heapIndex = -1;
+		task->_generation++;
+		task->_scheduled = false;
+	}
+	_heap.clear();
+}
+
+int Scheduler::run(ULONGLONG now)
+{
+	int steps = 0;
+	while(!_heap.empty() && _heap.front().deadline <= now){
+		Entry e = _heap.front();
+		remove(e.task);
+
+		unsigned int generation = e.task->_generation;
+		e.task->_scheduled = false;
+		int delay = e.task->step();
+		steps++;
+		if(e.task->_generation != generation){
+			// cancelled or restarted by its own step
+		}
+		else if(delay >= 0){
+			push(e.task, e.deadline + MILLIS_TO_MICROS(delay));
+		}
+		else{
+			e.task->finish();
+		}
+	}
+	return steps;
+}
+
+ULONGLONG Scheduler::nextDeadline()
+{
+	return _heap.empty() ? DEADLINE_NONE : _heap.front().deadline;
+}
+
+void Scheduler::push(ScheduledTask * task, ULONGLONG deadline)
+{
+	// a task has at most one entry, reserve() covers all of them
+	assert(task->_heapIndex < 0 && _heap.size() < _heap.capacity());
+	Entry e;
+	e.deadline = deadline;
+	e.order = _order++;
+	e.task = task;
+	task->_scheduled = true;
+	task->_deadline = deadline;
+	_heap.push_back(e);
+	place(static_cast<unsigned int>(_heap.size()-1), e);
+	siftUp(static_cast<unsigned int>(_heap.size()-1));
+}
+
+void Scheduler::remove(ScheduledTask * task)
+{
+	if(task->_heapIndex < 0)
+		return;
+	unsigned int i = static_cast<unsigned int>(task->_heapIndex);
+	task->_heapIndex = -1;
+	Entry last = _heap.back();
+	_heap.pop_back();
+	if(i == _heap.size())
+		return;
+	// the last entry fills the gap and moves up or down from there
+	place(i, last);
+	siftUp(i);
+	siftDown(static_cast<unsigned int>(last.task->_heapIndex));
+}
+
+void Scheduler::place(unsigned int i, const Entry & e)
+{
+	_heap[i] = e;
+	e.task->_heapIndex = static_cast<int>(i);
+}
+
+void Scheduler::siftUp(unsigned int i)
+{
+	Entry e = _heap[i];
+	while(i > 0){
+		unsigned int parent = (i-1)/2;
+		if(!Later()(_heap[parent], e))
+			break;
+		place(i, _heap[parent]);
+		i = parent;
+	}
+	place(i, e);
+}
+
+void Scheduler::siftDown(unsigned int i)
+{
+	Entry e = _heap[i];
+	unsigned int size = static_cast<unsigned int>(_heap.size());
+	while(true){
+		unsigned int child = 2*i + 1;
+		if(child >= size)
+			break;
+		if(child+1 < size && Later()(_heap[child], _heap[child+1]))
+			child++;
+		if(!Later()(e, _heap[child]))
+			break;
+		place(i, _heap[child]);
+		i = child;
+	}
+	place(i, e);
+}
@@ -0,0 +1,103 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Clock.h"
+#include <vector>
+
+// something that runs in timed steps (a hotkey sequence), driven by the Scheduler
+class ScheduledTask{
+public:
+	ScheduledTask(): _generation(0), _heapIndex(-1), _scheduled(false), _paused(false), _remaining(0), _deadline(0){}
+	virtual ~ScheduledTask(){}
+
+	// rewind to the first step, returns its delay (ms) or -1 if there is nothing to run
+	virtual int begin() = 0;
+
+	// run the step that is due, returns the delay (ms) of the next step or -1 if the task is done
+	virtual int step() = 0;
+
+	// called after the last step ran (not when the task is cancelled)
+	virtual void finish(){}
+
+	// task has a step pending
+	bool isScheduled(){return _scheduled;}
+
+	// task was paused with a step pending
+	bool isPaused(){return _paused;}
+
+	// scheduled or paused, the task has not completed yet
+	bool isRunning(){return _scheduled || _paused;}
+	// (monotonic micros) time the pending step is due, while step() runs the time it was due
+	ULONGLONG getDeadline(){return _deadline;}
+
+private:
+	friend class Scheduler;
+	unsigned int _generation; // counts cancels, tells if the task was cancelled or restarted by its own step
+	int _heapIndex; // position of the pending step in the heap, -1 if none
+	bool _scheduled;
+	bool _paused;
+	ULONGLONG _remaining; // time left until the pending step when the task was paused
+	ULONGLONG _deadline;
+};
+
+// min-heap of the next step of every running task, keyed by absolute monotonic deadline (micros).
+// Each step is due a fixed delay after the previous step's deadline (not after it actually ran),
+// so late wakeups do not add up over a sequence. Every task knows the position of its step in the heap,
+// cancelling removes it right away, so the heap never holds more entries than there are tasks.
+class Scheduler{
+public:
+	Scheduler(): _order(0){}
+
+	// (re)start task, its first step is due its delay after now
+	void start(ScheduledTask * task, ULONGLONG now);
+
+	// drop the pending step of task (also if it is paused)
+	void cancel(ScheduledTask * task);
+
+	// take the pending step of task off the schedule, resume() continues with the time that was left
+	void pause(ScheduledTask * task, ULONGLONG now);
+
+	// schedule the pending step of a paused task again, relative to now
+	void resume(ScheduledTask * task, ULONGLONG now);
+
+	// cancel all scheduled tasks (paused tasks stay paused)
+	void clear();
+
+	// run all steps due at or before now (in deadline order), returns number of steps run
+	int run(ULONGLONG now);
+
+	// deadline of the earliest pending step, DEADLINE_NONE if nothing is scheduled
+	ULONGLONG nextDeadline();
+
+	bool empty(){return _heap.empty();}
+
+	// preallocate for num_tasks running at the same time (all tasks that can be started), so starting,
+	// restarting or cancelling a task does not allocate
+	void reserve(int num_tasks){_heap.reserve(num_tasks);}
+
+private:
+	struct Entry{
+		ULONGLONG deadline;
+		unsigned long long order; // steps due at the same time run in the order they were scheduled
+		ScheduledTask * task;
+	};
+	struct Later{
+		bool operator()(const Entry & a, const Entry & b) const{
+			return a.deadline != b.deadline ? a.deadline > b.deadline : a.order > b.order;
+		}
+	};
+
+	void push(ScheduledTask * task, ULONGLONG deadline);
+	// take the pending step of task out of the heap
+	void remove(ScheduledTask * task);
+	// store e at position i of the heap and tell its task
+	void place(unsigned int i, const Entry & e);
+	// restore the heap order after the entry at i got an earlier / later key
+	void siftUp(unsigned int i);
+	void siftDown(unsigned int i);
+
+	std::vector<Entry> _heap;
+	unsigned long long _order;
+};
+
+#endif
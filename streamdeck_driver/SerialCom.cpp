@@ -1,17 +1,41 @@
 #include "SerialCom.h"
+#include "Protocol.h"
 
-Serial::Serial(const char *portName)
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+Serial * Serial::Open(const char *portName)
+{
+	return new Win32Serial(portName);
+}
+
+Win32Serial::Win32Serial(const char *portName)
 {
 	//We're not yet connected
 	this->connected = false;
+	this->waitPending = false;
+	this->asyncPending = false;
+	this->asyncWritePending = false;
+	ZeroMemory(&this->asyncWriteOverlapped, sizeof(OVERLAPPED));
+	ZeroMemory(&this->readOverlapped, sizeof(OVERLAPPED));
+	ZeroMemory(&this->writeOverlapped, sizeof(OVERLAPPED));
+	ZeroMemory(&this->waitOverlapped, sizeof(OVERLAPPED));
 
-	//Try to connect to the given port throuh CreateFile
+	//Try to connect to the given port throuh CreateFile,
+	//overlapped io is needed to wait for incoming data with a timeout
 	this->hSerial = CreateFileA(portName,
 		GENERIC_READ | GENERIC_WRITE,
 		0,
 		NULL,
 		OPEN_EXISTING,
-		FILE_ATTRIBUTE_NORMAL,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
 		NULL);
 
 	//Check if the connection was successfull
@@ -45,7 +69,7 @@ Serial::Serial(const char *portName)
 		else
 		{
 			//Define serial connection parameters for the arduino board
-			dcbSerialParams.BaudRate = CBR_9600;
+			dcbSerialParams.BaudRate = BAUD_RATE_V1;
 			dcbSerialParams.ByteSize = 8;
 			dcbSerialParams.StopBits = ONESTOPBIT;
 			dcbSerialParams.Parity = NOPARITY;
@@ -62,29 +86,51 @@ Serial::Serial(const char *portName)
 			{
 				//If everything went fine we're connected
 				this->connected = true;
-				//Flush any remaining characters in the buffers 
+				//Events signaled on completion of overlapped operations
+				this->readOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				this->writeOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				this->waitOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				this->asyncWriteOverlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+				//Only wake up waiters when a character has been received
+				SetCommMask(this->hSerial, EV_RXCHAR);
+				//Let ReadFile return as soon as at least one byte is available
+				COMMTIMEOUTS timeouts = { 0 };
+				timeouts.ReadIntervalTimeout = MAXDWORD;
+				timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
+				timeouts.ReadTotalTimeoutConstant = MAXDWORD - 1;
+				SetCommTimeouts(this->hSerial, &timeouts);
+				//Flush any remaining characters in the buffers, the arduino is reseting now
+				//and will announce itself (see discoverDeck)
 				PurgeComm(this->hSerial, PURGE_RXCLEAR | PURGE_TXCLEAR);
-				//We wait 2s as the arduino board will be reseting
-				Sleep(ARDUINO_WAIT_TIME);
 			}
 		}
 	}
 
 }
 
-Serial::~Serial()
+Win32Serial::~Win32Serial()
 {
 	//Check if we are connected before trying to disconnect
 	if (this->connected)
 	{
 		//We're no longer connected
 		this->connected = false;
+		//Abort a pending WaitCommEvent before the events are released
+		CancelIo(this->hSerial);
+		CloseHandle(this->readOverlapped.hEvent);
+		CloseHandle(this->writeOverlapped.hEvent);
+		CloseHandle(this->waitOverlapped.hEvent);
+		CloseHandle(this->asyncWriteOverlapped.hEvent);
 		//Close the serial handler
 		CloseHandle(this->hSerial);
 	}
+	else if (this->hSerial != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(this->hSerial);
+	}
 }
 
-int Serial::ReadData(char *buffer, unsigned int nbChar)
+int Win32Serial::ReadData(char *buffer, unsigned int nbChar)
 {
 	//Number of bytes we'll have read
 	DWORD bytesRead;
@@ -109,8 +155,11 @@ int Serial::ReadData(char *buffer, unsigned int nbChar)
 			toRead = this->status.cbInQue;
 		}
 
-		//Try to read the require number of chars, and return the number of read bytes on success
-		if (ReadFile(this->hSerial, buffer, toRead, &bytesRead, NULL))
+		//Try to read the require number of chars, and return the number of read bytes on success,
+		//the data is already queued so waiting for the result does not block
+		if (ReadFile(this->hSerial, buffer, toRead, &bytesRead, &this->readOverlapped) ||
+			(GetLastError() == ERROR_IO_PENDING &&
+			 GetOverlappedResult(this->hSerial, &this->readOverlapped, &bytesRead, TRUE)))
 		{
 			return bytesRead;
 		}
@@ -123,12 +172,14 @@ int Serial::ReadData(char *buffer, unsigned int nbChar)
 }
 
 
-bool Serial::WriteData(const char *buffer, unsigned int nbChar)
+bool Win32Serial::WriteData(const char *buffer, unsigned int nbChar)
 {
 	DWORD bytesSend;
 
 	//Try to write the buffer on the Serial port
-	if (!WriteFile(this->hSerial, (void *)buffer, nbChar, &bytesSend, 0))
+	if (!WriteFile(this->hSerial, (void *)buffer, nbChar, &bytesSend, &this->writeOverlapped) &&
+		(GetLastError() != ERROR_IO_PENDING ||
+		 !GetOverlappedResult(this->hSerial, &this->writeOverlapped, &bytesSend, TRUE)))
 	{
 		//In case it don't work get comm error and return false
 		ClearCommError(this->hSerial, &this->errors, &this->status);
@@ -139,8 +190,369 @@ bool Serial::WriteData(const char *buffer, unsigned int nbChar)
 		return true;
 }
 
-bool Serial::IsConnected()
+int Win32Serial::ReadData(char *buffer, unsigned int nbChar, int timeoutMs)
+{
+	//Wait for the first byte unless data is already queued
+	if (!this->ArmReadyHandle() &&
+		WaitForSingleObject(this->GetReadyHandle(), timeoutMs) != WAIT_OBJECT_0)
+	{
+		return 0;
+	}
+	return this->ReadData(buffer, nbChar);
+}
+
+bool Win32Serial::ReadAsync(char *buffer, unsigned int nbChar)
+{
+	DWORD bytesRead;
+
+	if (this->asyncPending)
+		return false;
+
+	//With the comm timeouts set in the constructor this completes as soon as any byte arrived
+	ResetEvent(this->readOverlapped.hEvent);
+	if (!ReadFile(this->hSerial, buffer, nbChar, &bytesRead, &this->readOverlapped) &&
+		GetLastError() != ERROR_IO_PENDING)
+	{
+		ClearCommError(this->hSerial, &this->errors, &this->status);
+		return false;
+	}
+	this->asyncPending = true;
+	return true;
+}
+
+int Win32Serial::GetAsyncResult(bool wait)
+{
+	DWORD bytesRead;
+
+	if (!this->asyncPending)
+		return 0;
+	if (!GetOverlappedResult(this->hSerial, &this->readOverlapped, &bytesRead, wait ? TRUE : FALSE))
+	{
+		if (GetLastError() == ERROR_IO_INCOMPLETE)
+			return -1;
+		bytesRead = 0;
+	}
+	this->asyncPending = false;
+	return bytesRead;
+}
+
+bool Win32Serial::WriteAsync(const char *buffer, unsigned int nbChar)
+{
+	if (nbChar > SERIAL_WRITE_BUFFER_SIZE || !this->IsWriteComplete())
+		return false;
+
+	//The buffer has to stay valid until the write completes
+	memcpy(this->writeBuffer, buffer, nbChar);
+	ResetEvent(this->asyncWriteOverlapped.hEvent);
+	if (!WriteFile(this->hSerial, this->writeBuffer, nbChar, NULL, &this->asyncWriteOverlapped))
+	{
+		if (GetLastError() != ERROR_IO_PENDING)
+		{
+			ClearCommError(this->hSerial, &this->errors, &this->status);
+			this->connected = false;
+			return false;
+		}
+		this->asyncWritePending = true;
+	}
+	return true;
+}
+
+bool Win32Serial::IsWriteComplete()
+{
+	DWORD bytesSend;
+
+	if (!this->asyncWritePending)
+		return true;
+	if (!GetOverlappedResult(this->hSerial, &this->asyncWriteOverlapped, &bytesSend, FALSE))
+	{
+		if (GetLastError() == ERROR_IO_INCOMPLETE)
+			return false;
+		this->connected = false;
+	}
+	this->asyncWritePending = false;
+	return true;
+}
+
+bool Win32Serial::ArmReadyHandle()
+{
+	DWORD unused;
+
+	//A pending ReadAsync signals its own completion
+	if (this->asyncPending)
+		return HasOverlappedIoCompleted(&this->readOverlapped) != FALSE;
+
+	//Collect a WaitCommEvent that has completed since the last call
+	if (this->waitPending && GetOverlappedResult(this->hSerial, &this->waitOverlapped, &unused, FALSE))
+		this->waitPending = false;
+
+	//Data already queued, no need to wait
+	ClearCommError(this->hSerial, &this->errors, &this->status);
+	if (this->status.cbInQue > 0)
+		return true;
+
+	if (!this->waitPending)
+	{
+		ResetEvent(this->waitOverlapped.hEvent);
+		if (WaitCommEvent(this->hSerial, &this->waitMask, &this->waitOverlapped))
+			return true;
+		//On errors let the caller find out through ReadData/WriteData
+		if (GetLastError() != ERROR_IO_PENDING)
+			return true;
+		this->waitPending = true;
+
+		//A character might have arrived before the wait was issued
+		ClearCommError(this->hSerial, &this->errors, &this->status);
+		if (this->status.cbInQue > 0)
+			return true;
+	}
+	return false;
+}
+
+SerialHandle Win32Serial::GetReadyHandle()
+{
+	return this->asyncPending ? this->readOverlapped.hEvent : this->waitOverlapped.hEvent;
+}
+
+bool Win32Serial::IsConnected()
 {
 	//Simply return the connection status
 	return this->connected;
-}
\ No newline at end of file
+}
+
+bool Win32Serial::SetBaudRate(unsigned int baudRate)
+{
+	DCB dcbSerialParams = { 0 };
+	dcbSerialParams.DCBlength = sizeof(dcbSerialParams);
+	if (!GetCommState(this->hSerial, &dcbSerialParams))
+		return false;
+	dcbSerialParams.BaudRate = baudRate;
+	return SetCommState(this->hSerial, &dcbSerialParams) != FALSE;
+}
+
+#else // POSIX
+
+Serial * Serial::Open(const char *portName)
+{
+	return new PosixSerial(portName);
+}
+
+PosixSerial::PosixSerial(const char *portName)
+{
+	//We're not yet connected
+	this->connected = false;
+	this->asyncBuffer = NULL;
+	this->asyncSize = 0;
+	this->writePending = 0;
+
+	//Try to open the tty, non blocking so reads return immediately
+	this->fd = open(portName, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (this->fd < 0)
+	{
+#ifndef SERIAL_NO_ERROR
+		printf("ERROR: Handle was not attached. Reason: %s not available.\n", portName);
+#endif
+		return;
+	}
+
+	struct termios tty;
+	if (tcgetattr(this->fd, &tty) != 0)
+	{
+		printf("failed to get current serial parameters!");
+	}
+	else
+	{
+		//Define serial connection parameters for the arduino board (raw 8N1)
+		cfmakeraw(&tty);
+		//BAUD_RATE_V1, the handshake always runs at 9600
+		cfsetispeed(&tty, B9600);
+		cfsetospeed(&tty, B9600);
+		//HUPCL drops DTR on close, so the Arduino is reset upon establishing a connection
+		tty.c_cflag |= CLOCAL | CREAD | HUPCL;
+		//Together with O_NONBLOCK an empty queue yields EAGAIN, a hangup yields 0
+		tty.c_cc[VMIN] = 1;
+		tty.c_cc[VTIME] = 0;
+
+		if (tcsetattr(this->fd, TCSANOW, &tty) != 0)
+		{
+			printf("ALERT: Could not set Serial Port parameters");
+		}
+		else
+		{
+			//If everything went fine we're connected
+			this->connected = true;
+			//Flush any remaining characters in the buffers, the arduino is reseting now
+			//and will announce itself (see discoverDeck)
+			tcflush(this->fd, TCIOFLUSH);
+		}
+	}
+
+	if (!this->connected)
+	{
+		close(this->fd);
+		this->fd = -1;
+	}
+}
+
+PosixSerial::~PosixSerial()
+{
+	if (this->fd >= 0)
+	{
+		this->connected = false;
+		close(this->fd);
+	}
+}
+
+int PosixSerial::ReadData(char *buffer, unsigned int nbChar)
+{
+	ssize_t bytesRead = read(this->fd, buffer, nbChar);
+	if (bytesRead > 0)
+		return (int)bytesRead;
+
+	//The device is gone (e.g. unplugged or pty closed)
+	if (bytesRead == 0 || (errno != EAGAIN && errno != EINTR))
+		this->connected = false;
+
+	//If nothing has been read, or that an error was detected return 0
+	return 0;
+}
+
+bool PosixSerial::WriteData(const char *buffer, unsigned int nbChar)
+{
+	unsigned int written = 0;
+	while (written < nbChar)
+	{
+		ssize_t n = write(this->fd, buffer + written, nbChar - written);
+		if (n > 0)
+		{
+			written += (unsigned int)n;
+		}
+		else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			//Output buffer full, wait until the tty accepts more data
+			struct pollfd p = { this->fd, POLLOUT, 0 };
+			if (poll(&p, 1, 100) <= 0)
+				return false;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int PosixSerial::ReadData(char *buffer, unsigned int nbChar, int timeoutMs)
+{
+	struct pollfd p = { this->fd, POLLIN, 0 };
+	int ready;
+	do
+	{
+		ready = poll(&p, 1, timeoutMs);
+	} while (ready < 0 && errno == EINTR);
+
+	if (ready <= 0)
+		return 0;
+	return this->ReadData(buffer, nbChar);
+}
+
+bool PosixSerial::ReadAsync(char *buffer, unsigned int nbChar)
+{
+	//Emulated: the read is performed once the fd becomes readable
+	if (this->asyncBuffer != NULL)
+		return false;
+	this->asyncBuffer = buffer;
+	this->asyncSize = nbChar;
+	return true;
+}
+
+int PosixSerial::GetAsyncResult(bool wait)
+{
+	if (this->asyncBuffer == NULL)
+		return 0;
+	int bytesRead = this->ReadData(this->asyncBuffer, this->asyncSize, wait ? -1 : 0);
+	if (bytesRead == 0 && this->connected)
+		return -1;
+	this->asyncBuffer = NULL;
+	return bytesRead;
+}
+
+bool PosixSerial::WriteAsync(const char *buffer, unsigned int nbChar)
+{
+	if (nbChar > SERIAL_WRITE_BUFFER_SIZE || !this->IsWriteComplete())
+		return false;
+
+	ssize_t n = write(this->fd, buffer, nbChar);
+	if (n < 0)
+	{
+		if (errno != EAGAIN && errno != EINTR)
+		{
+			this->connected = false;
+			return false;
+		}
+		n = 0;
+	}
+	//Keep what the tty did not accept, IsWriteComplete() pushes it out later
+	this->writePending = nbChar - (unsigned int)n;
+	memcpy(this->writeBuffer, buffer + n, this->writePending);
+	return true;
+}
+
+bool PosixSerial::IsWriteComplete()
+{
+	if (this->writePending == 0)
+		return true;
+
+	ssize_t n = write(this->fd, this->writeBuffer, this->writePending);
+	if (n < 0)
+	{
+		if (errno != EAGAIN && errno != EINTR)
+		{
+			this->connected = false;
+			this->writePending = 0;
+			return true;
+		}
+		return false;
+	}
+	this->writePending -= (unsigned int)n;
+	memmove(this->writeBuffer, this->writeBuffer + n, this->writePending);
+	return this->writePending == 0;
+}
+
+bool PosixSerial::ArmReadyHandle()
+{
+	//The file descriptor is level triggered, nothing to prepare
+	return false;
+}
+
+SerialHandle PosixSerial::GetReadyHandle()
+{
+	return this->fd;
+}
+
+bool PosixSerial::IsConnected()
+{
+	//Simply return the connection status
+	return this->connected;
+}
+
+bool PosixSerial::SetBaudRate(unsigned int baudRate)
+{
+	speed_t speed;
+	switch (baudRate)
+	{
+	case 9600: speed = B9600; break;
+	case 57600: speed = B57600; break;
+	case 115200: speed = B115200; break;
+	case 230400: speed = B230400; break;
+	default: return false;
+	}
+
+	struct termios tty;
+	if (tcgetattr(this->fd, &tty) != 0)
+		return false;
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+	return tcsetattr(this->fd, TCSADRAIN, &tty) == 0;
+}
+
+#endif
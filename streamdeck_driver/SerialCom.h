@@ -3,17 +3,69 @@
 #ifndef SERIALCOM_H
 #define SERIALCOM_H
 
-#define ARDUINO_WAIT_TIME 2000
+#define ARDUINO_WAIT_TIME 2000 // (ms) time the arduino needs to reset after the port was opened
 #define SERIAL_NO_ERROR // do not print error messages
+#define SERIAL_WRITE_BUFFER_SIZE 64 // max size of a single WriteAsync
 
-#include <windows.h>
+#include "Platform.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef _WIN32
+typedef HANDLE SerialHandle;
+#else
+typedef int SerialHandle;
+#endif
+
+//Transport to the stream deck, implemented by Win32Serial and PosixSerial
 class Serial
 {
+public:
+	//Open the serial implementation of the current platform on the given port
+	static Serial * Open(const char *portName);
+	//Close the connection
+	virtual ~Serial() {}
+	//Read data in a buffer, if nbChar is greater than the
+	//maximum number of bytes available, it will return only the
+	//bytes available. The function return -1 when nothing could
+	//be read, the number of bytes actually read.
+	virtual int ReadData(char *buffer, unsigned int nbChar) = 0;
+	//Same as above but waits up to timeoutMs milliseconds for the
+	//first byte to arrive, returns 0 on timeout.
+	virtual int ReadData(char *buffer, unsigned int nbChar, int timeoutMs) = 0;
+	//Start reading into buffer in the background, completion is signaled
+	//through the ready handle. Return false if the read could not be started.
+	virtual bool ReadAsync(char *buffer, unsigned int nbChar) = 0;
+	//Collect the result of ReadAsync: number of bytes read, -1 while the
+	//read is still pending (if wait is true this blocks until completion).
+	virtual int GetAsyncResult(bool wait) = 0;
+	//Writes data from a buffer through the Serial connection
+	//return true on success.
+	virtual bool WriteData(const char *buffer, unsigned int nbChar) = 0;
+	//Start writing (a copy of) buffer in the background without blocking, return false
+	//if the previous WriteAsync is still in progress or nbChar exceeds SERIAL_WRITE_BUFFER_SIZE.
+	//A failed write marks the connection as lost.
+	virtual bool WriteAsync(const char *buffer, unsigned int nbChar) = 0;
+	//Return true if no WriteAsync is in progress anymore
+	virtual bool IsWriteComplete() = 0;
+	//Check if we are actually connected
+	virtual bool IsConnected() = 0;
+	//Change the baud rate of the open connection, return true on success
+	virtual bool SetBaudRate(unsigned int baudRate) = 0;
+	//Prepare the readiness handle so it is signaled as soon as data arrives
+	//(or a pending ReadAsync completes), return true if there is no need to wait
+	virtual bool ArmReadyHandle() = 0;
+	//Handle that becomes signaled (Win32) or readable (POSIX) when data arrives
+	virtual SerialHandle GetReadyHandle() = 0;
+};
+
+#ifdef _WIN32
+
+class Win32Serial : public Serial
+{
 private:
-	//Serial comm handler
+	//Serial comm handler (opened for overlapped io)
 	HANDLE hSerial;
 	//Connection status
 	bool connected;
@@ -21,25 +73,69 @@ private:
 	COMSTAT status;
 	//Keep track of last error
 	DWORD errors;
+	//Overlapped structures for reading, writing and the pending WaitCommEvent
+	OVERLAPPED readOverlapped;
+	OVERLAPPED writeOverlapped;
+	OVERLAPPED waitOverlapped;
+	//Event mask filled by WaitCommEvent
+	DWORD waitMask;
+	//True while a WaitCommEvent is pending
+	bool waitPending;
+	//True while a ReadAsync is pending
+	bool asyncPending;
+	//Overlapped structure and data of a pending WriteAsync
+	OVERLAPPED asyncWriteOverlapped;
+	char writeBuffer[SERIAL_WRITE_BUFFER_SIZE];
+	bool asyncWritePending;
 
 public:
-	//Initialize Serial communication with the given COM port
-	Serial(const char *portName);
-	//Close the connection
-	~Serial();
-	//Read data in a buffer, if nbChar is greater than the
-	//maximum number of bytes available, it will return only the
-	//bytes available. The function return -1 when nothing could
-	//be read, the number of bytes actually read.
+	Win32Serial(const char *portName);
+	~Win32Serial();
 	int ReadData(char *buffer, unsigned int nbChar);
-	//Writes data from a buffer through the Serial connection
-	//return true on success.
+	int ReadData(char *buffer, unsigned int nbChar, int timeoutMs);
+	bool ReadAsync(char *buffer, unsigned int nbChar);
+	int GetAsyncResult(bool wait);
 	bool WriteData(const char *buffer, unsigned int nbChar);
-	//Check if we are actually connected
+	bool WriteAsync(const char *buffer, unsigned int nbChar);
+	bool IsWriteComplete();
 	bool IsConnected();
+	bool SetBaudRate(unsigned int baudRate);
+	bool ArmReadyHandle();
+	SerialHandle GetReadyHandle();
+};
 
+#else
 
+class PosixSerial : public Serial
+{
+private:
+	//File descriptor of the tty
+	int fd;
+	//Connection status
+	bool connected;
+	//Destination of a pending ReadAsync (NULL if none)
+	char *asyncBuffer;
+	unsigned int asyncSize;
+	//Data of a WriteAsync the tty did not accept yet
+	char writeBuffer[SERIAL_WRITE_BUFFER_SIZE];
+	unsigned int writePending;
+
+public:
+	PosixSerial(const char *portName);
+	~PosixSerial();
+	int ReadData(char *buffer, unsigned int nbChar);
+	int ReadData(char *buffer, unsigned int nbChar, int timeoutMs);
+	bool ReadAsync(char *buffer, unsigned int nbChar);
+	int GetAsyncResult(bool wait);
+	bool WriteData(const char *buffer, unsigned int nbChar);
+	bool WriteAsync(const char *buffer, unsigned int nbChar);
+	bool IsWriteComplete();
+	bool IsConnected();
+	bool SetBaudRate(unsigned int baudRate);
+	bool ArmReadyHandle();
+	SerialHandle GetReadyHandle();
 };
 
-#endif // SERIALCLASS_H_INCLUDED
+#endif
 
+#endif // SERIALCLASS_H_INCLUDED
@@ -0,0 +1,49 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+
+// bounded lock-free queue from exactly one producer thread to exactly one consumer thread,
+// neither side ever blocks or allocates after construction
+template <typename T>
+class SpscQueue{
+public:
+	// capacity is rounded up to a power of two
+	SpscQueue(unsigned int capacity): _head(0), _tail(0){
+		unsigned int size = 1;
+		while(size < capacity)
+			size *= 2;
+		_items.resize(size);
+		_mask = size-1;
+	}
+
+	// append item (producer only), returns false if the queue is full
+	bool push(const T & item){
+		unsigned int tail = _tail.load(std::memory_order_relaxed);
+		if(tail - _head.load(std::memory_order_acquire) > _mask)
+			return false;
+		_items[tail & _mask] = item;
+		_tail.store(tail+1, std::memory_order_release);
+		return true;
+	}
+
+	// remove the oldest item (consumer only), returns false if the queue is empty
+	bool pop(T & item){
+		unsigned int head = _head.load(std::memory_order_relaxed);
+		if(head == _tail.load(std::memory_order_acquire))
+			return false;
+		item = _items[head & _mask];
+		_head.store(head+1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> _items;
+	unsigned int _mask;
+	// written by different threads, kept on separate cache lines
+	alignas(64) std::atomic<unsigned int> _head; // next item to pop
+	alignas(64) std::atomic<unsigned int> _tail; // next slot to push to
+};
+
+#endif
@@ -0,0 +1,426 @@
+#include "Stats.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+static const char * STAGE_NAMES[NUM_STAGES] = {"dispatch", "late", "send", "total"};
+
+// bucket of value: values below HISTOGRAM_SUB_BUCKETS have their own bucket, above that each power of two
+// is split into HISTOGRAM_SUB_BUCKETS buckets
+static unsigned int bucketIndex(unsigned int value)
+{
+	if(value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+	unsigned int e = 0;
+	while((value >> e) > 1)
+		e++;
+	return (e - HISTOGRAM_SUB_BITS + 1)*HISTOGRAM_SUB_BUCKETS + ((value >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS-1));
+}
+
+// largest value that falls into bucket index
+static unsigned int bucketLimit(unsigned int index)
+{
+	if(index < HISTOGRAM_SUB_BUCKETS)
+		return index;
+	unsigned int shift = index/HISTOGRAM_SUB_BUCKETS - 1;
+	unsigned long long lower = static_cast<unsigned long long>(HISTOGRAM_SUB_BUCKETS + index%HISTOGRAM_SUB_BUCKETS) << shift;
+	return static_cast<unsigned int>(lower + (1ULL << shift) - 1);
+}
+
+Histogram::Histogram(): _count(0), _max(0)
+{
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+		_buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record(ULONGLONG micros)
+{
+	unsigned int value = micros > 0xFFFFFFFFULL ? 0xFFFFFFFFU : static_cast<unsigned int>(micros);
+	// single writer, no read-modify-write needed
+	std::atomic<unsigned int> & bucket = _buckets[bucketIndex(value)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if(value > _max.load(std::memory_order_relaxed))
+		_max.store(value, std::memory_order_relaxed);
+	_count.store(_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+unsigned int Histogram::getPercentile(double p)
+{
+	// the buckets may change while they are read, use their own total
+	unsigned int counts[HISTOGRAM_BUCKETS];
+	unsigned long long total = 0;
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+		counts[i] = _buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if(total == 0)
+		return 0;
+	unsigned long long rank = static_cast<unsigned long long>(p/100.0*total + 0.5);
+	if(rank < 1)
+		rank = 1;
+	unsigned long long seen = 0;
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+		seen += counts[i];
+		if(seen >= rank){
+			unsigned int limit = bucketLimit(i);
+			unsigned int max = getMax();
+			return limit < max ? limit : max;
+		}
+	}
+	return getMax();
+}
+
+LatencyStats::LatencyStats()
+{
+	for(int i = 0; i <= MAX_DECK_ID; i++)
+		_decks[i].store(NULL, std::memory_order_relaxed);
+	_queued.reserve(STATS_QUEUE_RESERVE);
+}
+
+LatencyStats::~LatencyStats()
+{
+	for(int i = 0; i <= MAX_DECK_ID; i++){
+		DeckHistograms * deck = _decks[i].load();
+		if(deck == NULL)
+			continue;
+		for(int b = 0; b < MAX_DEVICE_BUTTONS; b++)
+			delete deck->buttons[b].load();
+		delete deck;
+	}
+}
+
+void LatencyStats::addDeck(int deck, int num_buttons)
+{
+	DeckHistograms * d = _decks[deck].load(std::memory_order_acquire);
+	if(d == NULL){
+		d = new DeckHistograms();
+		for(int b = 0; b < MAX_DEVICE_BUTTONS; b++)
+			d->buttons[b].store(NULL, std::memory_order_relaxed);
+		_decks[deck].store(d, std::memory_order_release);
+	}
+	// a reconnect can report more buttons, histograms of the previous connection are kept
+	for(int b = 0; b < num_buttons && b < MAX_DEVICE_BUTTONS; b++){
+		if(d->buttons[b].load(std::memory_order_relaxed) == NULL)
+			d->buttons[b].store(new Histogram(), std::memory_order_release);
+	}
+}
+
+Histogram * LatencyStats::getButton(int deck, int button)
+{
+	DeckHistograms * d = _decks[deck].load(std::memory_order_acquire);
+	if(d == NULL)
+		return NULL;
+	return d->buttons[button-1].load(std::memory_order_acquire);
+}
+
+void LatencyStats::record(int stage, ULONGLONG micros)
+{
+	_stages[stage].record(micros);
+}
+
+void LatencyStats::queueStep(int deck, int button, ULONGLONG deadline, ULONGLONG received, ULONGLONG start)
+{
+	QueuedStep s;
+	s.deck = deck;
+	s.button = button;
+	s.deadline = deadline;
+	s.received = received;
+	s.start = start;
+	_queued.push_back(s);
+}
+
+void LatencyStats::sent(ULONGLONG send_start, ULONGLONG send_end)
+{
+	if(_queued.empty())
+		return;
+	_stages[STAGE_SEND].record(send_end - send_start);
+	for(unsigned int i = 0; i < _queued.size(); i++){
+		const QueuedStep & s = _queued[i];
+		_stages[STAGE_LATE].record(send_end > s.deadline ? send_end - s.deadline : 0);
+		if(s.received == 0)
+			continue;
+		// the configured delay of the first key is not latency
+		ULONGLONG total = (s.start - s.received) + (send_end > s.deadline ? send_end - s.deadline : 0);
+		_stages[STAGE_TOTAL].record(total);
+		Histogram * button = getButton(s.deck, s.button);
+		if(button != NULL)
+			button->record(total);
+	}
+	_queued.clear();
+}
+
+// one table row
+static void appendRow(std::string & text, const char * name, Histogram & h)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%-14s %8u %8u %8u %8u\n", name, h.getCount(), h.getPercentile(50), h.getPercentile(99), h.getMax());
+	text += line;
+}
+
+void LatencyStats::dump(std::string & text)
+{
+	text += "stage             count  p50(us)  p99(us)  max(us)\n";
+	for(int i = 0; i < NUM_STAGES; i++)
+		appendRow(text, STAGE_NAMES[i], _stages[i]);
+	text += "\ndeck/button       count  p50(us)  p99(us)  max(us)\n";
+	for(int d = 0; d <= MAX_DECK_ID; d++){
+		DeckHistograms * deck = _decks[d].load(std::memory_order_acquire);
+		if(deck == NULL)
+			continue;
+		for(int b = 0; b < MAX_DEVICE_BUTTONS; b++){
+			// buttons that were never pressed are left out
+			Histogram * h = deck->buttons[b].load(std::memory_order_acquire);
+			if(h == NULL || h->getCount() == 0)
+				continue;
+			char name[16];
+			snprintf(name, sizeof(name), "%d/%d", d, b+1);
+			appendRow(text, name, *h);
+		}
+	}
+}
+
+void LatencyStats::summary(std::string & text)
+{
+	char part[96];
+	snprintf(part, sizeof(part), "Stats: %u presses", getNumPresses());
+	text += part;
+	for(int i = 0; i < NUM_STAGES; i++){
+		snprintf(part, sizeof(part), ", %s %u/%u/%u", STAGE_NAMES[i],
+			_stages[i].getPercentile(50), _stages[i].getPercentile(99), _stages[i].getMax());
+		text += part;
+	}
+	text += " us (p50/p99/max)";
+}
+
+StatsServer::StatsServer(): _stats(NULL)
+{
+#ifdef _WIN32
+	_stopEvent = NULL;
+#else
+	_socket = -1;
+	_stopPipe[0] = _stopPipe[1] = -1;
+#endif
+}
+
+StatsServer::~StatsServer()
+{
+	stop();
+}
+
+#ifdef _WIN32
+
+void getStatsAddress(char * address)
+{
+	strcpy(address, STATS_PIPE_NAME);
+}
+
+bool StatsServer::start(LatencyStats * stats)
+{
+	_stats = stats;
+	_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(_stopEvent == NULL)
+		return false;
+	_thread = std::thread(&StatsServer::run, this);
+	return true;
+}
+
+void StatsServer::stop()
+{
+	if(_stopEvent != NULL)
+		SetEvent(_stopEvent);
+	if(_thread.joinable())
+		_thread.join();
+	if(_stopEvent != NULL)
+		CloseHandle(_stopEvent);
+	_stopEvent = NULL;
+}
+
+void StatsServer::run()
+{
+	OVERLAPPED overlapped;
+	ZeroMemory(&overlapped, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	while(true){
+		HANDLE pipe = CreateNamedPipeA(STATS_PIPE_NAME, PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES, 4096, 0, 0, NULL);
+		if(pipe == INVALID_HANDLE_VALUE){
+			fprintf(stderr, "Could not create %s: 0x%x\n", STATS_PIPE_NAME, HRESULT_FROM_WIN32(GetLastError()));
+			break;
+		}
+		ResetEvent(overlapped.hEvent);
+		bool connected = ConnectNamedPipe(pipe, &overlapped) != 0 || GetLastError() == ERROR_PIPE_CONNECTED;
+		if(!connected && GetLastError() == ERROR_IO_PENDING){
+			HANDLE handles[2] = {_stopEvent, overlapped.hEvent};
+			if(WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0){
+				CancelIo(pipe);
+				CloseHandle(pipe);
+				break;
+			}
+			DWORD unused;
+			connected = GetOverlappedResult(pipe, &overlapped, &unused, FALSE) != 0;
+		}
+		if(connected){
+			std::string text;
+			_stats->dump(text);
+			ResetEvent(overlapped.hEvent);
+			DWORD written = 0;
+			if(!WriteFile(pipe, text.data(), static_cast<DWORD>(text.size()), &written, &overlapped) && GetLastError() == ERROR_IO_PENDING)
+				GetOverlappedResult(pipe, &overlapped, &written, TRUE);
+			FlushFileBuffers(pipe);
+			DisconnectNamedPipe(pipe);
+		}
+		CloseHandle(pipe);
+	}
+	CloseHandle(overlapped.hEvent);
+}
+
+bool printRemoteStats()
+{
+	HANDLE pipe = CreateFileA(STATS_PIPE_NAME, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if(pipe == INVALID_HANDLE_VALUE && GetLastError() == ERROR_PIPE_BUSY && WaitNamedPipeA(STATS_PIPE_NAME, 1000))
+		pipe = CreateFileA(STATS_PIPE_NAME, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if(pipe == INVALID_HANDLE_VALUE)
+		return false;
+	char buffer[512];
+	DWORD bytes_read;
+	while(ReadFile(pipe, buffer, sizeof(buffer), &bytes_read, NULL) && bytes_read > 0)
+		fwrite(buffer, 1, bytes_read, stdout);
+	CloseHandle(pipe);
+	return true;
+}
+
+#else
+
+void getStatsAddress(char * address)
+{
+	getProfileDirectory(address);
+	strcat(address, PATH_SEPARATOR STATS_SOCKET_FILE);
+}
+
+// something accepts connections on address
+static bool isServing(const struct sockaddr_un & address)
+{
+	int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(s < 0)
+		return false;
+	bool serving = connect(s, reinterpret_cast<const struct sockaddr*>(&address), sizeof(address)) == 0;
+	close(s);
+	return serving;
+}
+
+bool StatsServer::start(LatencyStats * stats)
+{
+	_stats = stats;
+	char address[MAX_PATH];
+	getStatsAddress(address);
+	_path = address;
+	struct sockaddr_un a;
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	if(_path.size() >= sizeof(a.sun_path)){
+		fprintf(stderr, "Stats address %s is too long!\n", address);
+		return false;
+	}
+	strcpy(a.sun_path, _path.c_str());
+
+	// the socket of a driver that is still running is left alone
+	if(isServing(a)){
+		fprintf(stderr, "Another driver is serving stats on %s!\n", address);
+		return false;
+	}
+	_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	// nobody is listening, left over by a driver that did not exit cleanly
+	unlink(_path.c_str());
+	if(_socket < 0 || bind(_socket, reinterpret_cast<struct sockaddr*>(&a), sizeof(a)) < 0 || listen(_socket, 4) < 0 || pipe(_stopPipe) < 0){
+		fprintf(stderr, "Could not create %s: %s\n", _path.c_str(), strerror(errno));
+		stop();
+		return false;
+	}
+	_thread = std::thread(&StatsServer::run, this);
+	return true;
+}
+
+void StatsServer::stop()
+{
+	if(_stopPipe[1] >= 0){
+		char c = 0;
+		if(write(_stopPipe[1], &c, 1) < 0){
+			// thread is gone already
+		}
+	}
+	if(_thread.joinable())
+		_thread.join();
+	if(_socket >= 0){
+		close(_socket);
+		unlink(_path.c_str());
+	}
+	if(_stopPipe[0] >= 0)
+		close(_stopPipe[0]);
+	if(_stopPipe[1] >= 0)
+		close(_stopPipe[1]);
+	_socket = -1;
+	_stopPipe[0] = _stopPipe[1] = -1;
+}
+
+void StatsServer::run()
+{
+	struct pollfd p[2];
+	p[0].fd = _socket;
+	p[0].events = POLLIN;
+	p[1].fd = _stopPipe[0];
+	p[1].events = POLLIN;
+	while(true){
+		if(poll(p, 2, -1) < 0 && errno != EINTR)
+			break;
+		if(p[1].revents != 0)
+			break;
+		if(p[0].revents == 0)
+			continue;
+		int client = accept(_socket, NULL, NULL);
+		if(client < 0)
+			continue;
+		std::string text;
+		_stats->dump(text);
+		size_t written = 0;
+		while(written < text.size()){
+			ssize_t n = send(client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+			if(n <= 0)
+				break;
+			written += n;
+		}
+		close(client);
+	}
+}
+
+bool printRemoteStats()
+{
+	char address[MAX_PATH];
+	getStatsAddress(address);
+	struct sockaddr_un a;
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	if(strlen(address) >= sizeof(a.sun_path)){
+		fprintf(stderr, "Stats address %s is too long!\n", address);
+		return false;
+	}
+	strcpy(a.sun_path, address);
+	int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(s < 0 || connect(s, reinterpret_cast<struct sockaddr*>(&a), sizeof(a)) < 0){
+		if(s >= 0)
+			close(s);
+		return false;
+	}
+	char buffer[512];
+	ssize_t n;
+	while((n = read(s, buffer, sizeof(buffer))) > 0)
+		fwrite(buffer, 1, n, stdout);
+	close(s);
+	return true;
+}
+
+#endif
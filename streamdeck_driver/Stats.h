@@ -0,0 +1,133 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "Platform.h"
+#include "Protocol.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define HISTOGRAM_SUB_BITS		3	// each power of two is split into 2^3 buckets (values are off by at most 12.5%)
+#define HISTOGRAM_SUB_BUCKETS	(1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS		((32 - HISTOGRAM_SUB_BITS + 1)*HISTOGRAM_SUB_BUCKETS)
+
+// stages of a button press, in order
+#define STAGE_DISPATCH	0 // serial data read until the sequence was started
+#define STAGE_LATE		1 // planned deadline of a step until its inputs were sent
+#define STAGE_SEND		2 // duration of the SendInput call (all steps of a tick)
+#define STAGE_TOTAL		3 // serial data read until the first inputs were sent (delay before the first key not included)
+#define NUM_STAGES		4
+
+#define STATS_INTERVAL_DEFAULT 60	// (s) default for option 'stats_interval'
+#define STATS_QUEUE_RESERVE 256		// steps queued between two sends before the queue has to grow
+#ifdef _WIN32
+#define STATS_PIPE_NAME "\\\\.\\pipe\\streamdeck_stats"	// named pipe serving the stats dump
+#else
+#define STATS_SOCKET_FILE ".streamdeck_stats"			// unix socket serving the stats dump (in the user's profile directory)
+#endif
+
+// latencies (micros) in logarithmic buckets, written by one thread and read by any number of threads without locking
+class Histogram{
+public:
+	Histogram();
+
+	// add a sample (only from the writing thread)
+	void record(ULONGLONG micros);
+
+	unsigned int getCount(){return _count.load(std::memory_order_relaxed);}
+	unsigned int getMax(){return _max.load(std::memory_order_relaxed);}
+
+	// upper bound of the bucket holding the p-th percentile (0..100) of the samples so far, 0 if there are none
+	unsigned int getPercentile(double p);
+
+private:
+	std::atomic<unsigned int> _buckets[HISTOGRAM_BUCKETS];
+	std::atomic<unsigned int> _count;
+	std::atomic<unsigned int> _max;
+};
+
+// latency of each stage and the time from press to keys of each button, recorded by the session loop,
+// dumped by any thread
+class LatencyStats{
+public:
+	LatencyStats();
+	~LatencyStats();
+
+	void record(int stage, ULONGLONG micros);
+
+	// allocate the histograms of deck's buttons 1..num_buttons when it connects (any one thread),
+	// so recording a press never allocates
+	void addDeck(int deck, int num_buttons);
+
+	// step of a button queued its inputs, due at deadline. For the first step of a press received is the time the
+	// press was read and start the time its sequence was started (both 0 otherwise)
+	void queueStep(int deck, int button, ULONGLONG deadline, ULONGLONG received, ULONGLONG start);
+
+	// the queued steps were sent by a call that took from send_start until send_end
+	void sent(ULONGLONG send_start, ULONGLONG send_end);
+
+	// presses that reached the output so far
+	unsigned int getNumPresses(){return _stages[STAGE_TOTAL].getCount();}
+
+	// table of all stages and buttons
+	void dump(std::string & text);
+
+	// one line with p50/p99/max of each stage
+	void summary(std::string & text);
+
+private:
+	struct QueuedStep{
+		int deck;
+		int button;
+		ULONGLONG deadline;
+		ULONGLONG received;
+		ULONGLONG start;
+	};
+
+	// button histograms of a deck, allocated when it connects
+	struct DeckHistograms{
+		std::atomic<Histogram*> buttons[MAX_DEVICE_BUTTONS];
+	};
+
+	// histogram of button of deck, NULL if the deck did not report that button
+	Histogram * getButton(int deck, int button);
+
+	Histogram _stages[NUM_STAGES];
+	std::atomic<DeckHistograms*> _decks[MAX_DECK_ID+1];
+	std::vector<QueuedStep> _queued; // steps since the last sent() (writing thread only)
+};
+
+// serves LatencyStats::dump() to every client of a named pipe (Win32) or unix socket (Linux) on a background thread
+class StatsServer{
+public:
+	StatsServer();
+	~StatsServer();
+
+	// start serving, return false if the pipe/socket cannot be created
+	bool start(LatencyStats * stats);
+
+	// stop serving and wait for the thread
+	void stop();
+
+private:
+	void run();
+
+	LatencyStats * _stats;
+	std::thread _thread;
+#ifdef _WIN32
+	HANDLE _stopEvent;
+#else
+	int _socket;
+	int _stopPipe[2];
+	std::string _path;
+#endif
+};
+
+// write address of the stats pipe/socket (MAX_PATH)
+void getStatsAddress(char * address);
+
+// print the dump of a running driver to stdout, return false if no driver is running
+bool printRemoteStats();
+
+#endif